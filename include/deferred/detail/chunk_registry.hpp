@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "memory_chunk_header.hpp"
+
+namespace def::detail
+{
+
+struct deferred_memory_deleter
+{
+    void operator()(memory_chunk_header*) const;
+};
+
+/// Destroy and deallocate chunks grouped by type, so that every
+/// type helper is called once per group. Chunks are reordered.
+void release_chunks(memory_chunk_header** chunks, std::size_t number);
+/// Same for destructors only and for memory of destroyed chunks.
+void destroy_chunks(memory_chunk_header** chunks, std::size_t number);
+void deallocate_chunks(memory_chunk_header** chunks, std::size_t number);
+
+/// Chunks owned by heap, indexed by chunk slot.
+/// Chunks are kept in fixed size segments, so that growing
+/// registry never moves chunks already registered, and
+/// releasing chunks keeps storage for following allocations.
+class chunk_registry
+{
+public:
+    using value_type = std::unique_ptr<memory_chunk_header,
+                                       deferred_memory_deleter>;
+    using size_type = std::size_t;
+
+    static constexpr size_type segment_size = 1024u;
+    /// Max number of chunks released together by truncate.
+    static constexpr size_type release_batch_size = 256u;
+
+    template <bool is_const>
+    class basic_iterator;
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+public:
+    chunk_registry();
+
+    chunk_registry(const chunk_registry&) = delete;
+    chunk_registry& operator=(const chunk_registry&) = delete;
+
+    ~chunk_registry();
+
+    size_type size() const noexcept;
+    bool empty() const noexcept;
+
+    value_type& operator[](size_type i) noexcept
+    {
+        return m_segments[i / segment_size][i % segment_size];
+    }
+
+    const value_type& operator[](size_type i) const noexcept
+    {
+        return m_segments[i / segment_size][i % segment_size];
+    }
+
+    void push_back(value_type&&);
+    /// Release chunks starting from given index.
+    void truncate(size_type new_size) noexcept;
+    void clear() noexcept;
+
+    iterator begin() noexcept;
+    iterator end() noexcept;
+    const_iterator begin() const noexcept;
+    const_iterator end() const noexcept;
+
+private:
+    using segment = std::unique_ptr<value_type[]>;
+
+    std::vector<segment> m_segments;
+    size_type m_size;
+
+}; // class chunk_registry
+
+template <bool is_const>
+class chunk_registry::basic_iterator
+{
+    using registry = std::conditional_t<is_const,
+                                        const chunk_registry, chunk_registry>;
+
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = chunk_registry::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<is_const,
+                                       const value_type*, value_type*>;
+    using reference = std::conditional_t<is_const,
+                                         const value_type&, value_type&>;
+
+public:
+    basic_iterator(registry& r, size_type i) noexcept
+    : m_registry{&r}
+    , m_index{i}
+    { }
+
+    reference operator*() const noexcept
+    {
+        return (*m_registry)[m_index];
+    }
+
+    pointer operator->() const noexcept
+    {
+        return &(*m_registry)[m_index];
+    }
+
+    reference operator[](difference_type n) const noexcept
+    {
+        return (*m_registry)[m_index + n];
+    }
+
+    basic_iterator& operator++() noexcept
+    {
+        ++m_index;
+        return *this;
+    }
+
+    basic_iterator operator++(int) noexcept
+    {
+        auto tmp = *this;
+        ++m_index;
+        return tmp;
+    }
+
+    basic_iterator& operator--() noexcept
+    {
+        --m_index;
+        return *this;
+    }
+
+    basic_iterator operator--(int) noexcept
+    {
+        auto tmp = *this;
+        --m_index;
+        return tmp;
+    }
+
+    basic_iterator& operator+=(difference_type n) noexcept
+    {
+        m_index += n;
+        return *this;
+    }
+
+    basic_iterator& operator-=(difference_type n) noexcept
+    {
+        m_index -= n;
+        return *this;
+    }
+
+    basic_iterator operator+(difference_type n) const noexcept
+    {
+        return basic_iterator{*m_registry, m_index + n};
+    }
+
+    basic_iterator operator-(difference_type n) const noexcept
+    {
+        return basic_iterator{*m_registry, m_index - n};
+    }
+
+    difference_type operator-(const basic_iterator& other) const noexcept
+    {
+        return static_cast<difference_type>(m_index)
+               - static_cast<difference_type>(other.m_index);
+    }
+
+    bool operator==(const basic_iterator& other) const noexcept
+    {
+        return m_index == other.m_index;
+    }
+
+    bool operator!=(const basic_iterator& other) const noexcept
+    {
+        return m_index != other.m_index;
+    }
+
+    bool operator<(const basic_iterator& other) const noexcept
+    {
+        return m_index < other.m_index;
+    }
+
+private:
+    registry* m_registry;
+    size_type m_index;
+
+}; // class chunk_registry::basic_iterator<is_const>
+
+} // namespace def::detail
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <memory_resource>
 
 #include "deferred_simple_allocator.hpp"
 
@@ -20,6 +22,7 @@ public:
     using chunks_number = std::size_t;
     using objects_number = std::size_t;
     using bytes_number = std::size_t;
+    using size_type = std::size_t;
 
     struct stats
     {
@@ -31,6 +34,13 @@ public:
 
 public:
     deferred_heap();
+    /// Memory of chunks allocated by make_deferred is taken
+    /// from given resource, which should outlive the heap.
+    /// Resource is used only by thread using the heap and
+    /// threads allocating with their allocators, it should
+    /// be thread safe if they run simultaneously.
+    /// Chunks allocated with allocate_deferred use given allocator.
+    explicit deferred_heap(std::pmr::memory_resource*);
 
     deferred_heap(const deferred_heap&) = delete;
     deferred_heap(deferred_heap&&) = delete;
@@ -41,15 +51,108 @@ public:
     deferred_heap& operator=(const deferred_heap&) = delete;
     deferred_heap& operator=(deferred_heap&&) = delete;
 
+    std::pmr::memory_resource* get_memory_resource() const noexcept;
+
     simple_allocator get_simple_allocator();
+    /// Allocator for calling thread only. Several threads
+    /// may allocate from heap simultaneously with their allocators,
+    /// allocation takes no lock. Chunks allocated by thread
+    /// are moved to heap when collection starts, so collection
+    /// and heap settings should not run concurrently with allocations.
+    /// Chunks destroyed through thread allocator are always
+    /// left to collection.
+    simple_allocator get_thread_allocator();
     stats release_unreachable();
 
+    /// Totals of all chunks are kept up to date by heap,
+    /// so they are cheap and can be read from any thread.
     chunks_number get_memory_chunks_number() const;
-    chunks_number get_root_memory_chunks_number() const;
     objects_number get_objects_number() const;
-    objects_number get_root_objects_number() const;
     bytes_number get_total_bytes() const;
 
+    chunks_number get_root_memory_chunks_number() const;
+    objects_number get_root_objects_number() const;
+
+    /// Max number of chunks kept in mark stack while tracing.
+    /// Tracing never allocates more, if stack overflows heap falls back
+    /// to rescanning already visited chunks.
+    size_type get_mark_stack_limit() const;
+    void set_mark_stack_limit(size_type);
+
+    /// Number of threads used to trace heap, 1 by default.
+    /// Calling thread is one of them.
+    size_type get_mark_threads_number() const;
+    void set_mark_threads_number(size_type);
+
+    /// Keep mark bits in dense bitmap owned by heap instead of
+    /// chunk headers, so that marking does not write to live chunks.
+    /// Disabled by default.
+    bool is_mark_bitmap_enabled() const;
+    void set_mark_bitmap_enabled(bool);
+
+    /// Release memory of chunk destroyed by destroy_deferred right
+    /// away instead of on next collection. There should be no other
+    /// pointers to destroyed objects left, they would dangle.
+    /// Chunk that is still root, old chunk of generational heap
+    /// and chunk destroyed during collection are left to collection.
+    /// Disabled by default.
+    bool is_eager_reclamation_enabled() const;
+    void set_eager_reclamation_enabled(bool);
+
+    /// Lazy sweeping, disabled by default. Unreachable chunks found
+    /// by collection are queued instead of being destroyed, so that
+    /// collection pause covers only marking. Queued chunks are
+    /// destroyed a few at a time by every chunk allocated with heap
+    /// allocator, by sweep_step, and all at once when next collection
+    /// begins or lazy sweeping is disabled. Statistics of collection
+    /// and heap totals count queued chunks as released.
+    /// Sweeping is part of collection, it should not run concurrently
+    /// with thread allocators.
+    bool is_lazy_sweep_enabled() const;
+    void set_lazy_sweep_enabled(bool);
+    /// Destroy queued chunks for about given time budget.
+    /// Return true when no queued chunks are left.
+    /// Memory of chunks destroyed by finalizer threads is released.
+    bool sweep_step(std::chrono::nanoseconds budget);
+    chunks_number get_unswept_chunks_number() const;
+
+    /// Number of background threads destroying unreachable chunks,
+    /// 0 by default, when chunks are destroyed by collecting thread.
+    /// Collection hands unreachable chunks over to finalizer threads
+    /// instead of sweeping them, their destructors run concurrently
+    /// with program, so they should not use heap or shared state
+    /// without synchronization. Memory of destroyed chunks is released
+    /// by heap allocator and collection, same as in lazy sweeping.
+    /// Changing number of threads waits for handed over chunks.
+    size_type get_finalizer_threads_number() const;
+    void set_finalizer_threads_number(size_type);
+
+#ifdef DEF_ENABLE_WRITE_BARRIER
+    /// Incremental collection, available only when library is built
+    /// with write barrier (DEFERRED_HEAP_WRITE_BARRIER cmake option).
+    /// Heap is marked in steps interleaved with program execution,
+    /// each step takes about given time budget. Step returns true
+    /// when marking is done. finish_collection completes marking
+    /// and releases unreachable chunks, release_unreachable
+    /// called in the middle of collection does the same.
+    /// Chunks allocated during collection survive it.
+    void begin_collection();
+    bool step(std::chrono::nanoseconds budget);
+    stats finish_collection();
+    bool is_collecting() const;
+
+    /// Generational mode, disabled by default. Chunks that survived
+    /// collection are old and stay marked, release_unreachable
+    /// traces only young chunks, reachable from young roots or from
+    /// old chunks changed since last collection. Old chunks of types
+    /// with containers or visit method are rescanned every time.
+    /// Full collection runs when old generation doubles,
+    /// or explicitly with release_all_unreachable.
+    bool is_generational_enabled() const;
+    void set_generational_enabled(bool);
+    stats release_all_unreachable();
+#endif // DEF_ENABLE_WRITE_BARRIER
+
 private:
     const std::unique_ptr<detail::deferred_heap_impl> m_pimpl;
 
@@ -1,18 +1,37 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "memory_chunk_header.hpp"
+#include "chunk_registry.hpp"
+#include "slab_allocator.hpp"
+#include "mark_stack.hpp"
+#include "mark_bitmap.hpp"
+#include "parallel_marker.hpp"
+#include "finalizer_pool.hpp"
+#include "write_barrier.hpp"
+#include "heap_registry.hpp"
+#include "thread_allocation_context.hpp"
 
-namespace def::detail
+namespace def
 {
 
-struct deferred_memory_deleter
+class visitor;
+
+} // namespace def
+
+namespace def::detail
 {
-    void operator()(memory_chunk_header*) const;
-};
 
 class deferred_heap_impl
 {
@@ -21,12 +40,17 @@ public:
     using bytes_number = std::size_t;
     using objects_number = std::size_t;
 
-    using chunk_unique_ptr = std::unique_ptr<detail::memory_chunk_header,
-                                             detail::deferred_memory_deleter>;
+    using chunk_unique_ptr = chunk_registry::value_type;
     using chunk_ptr = detail::memory_chunk_header*;
+    using size_type = std::size_t;
+    using epoch_type = memory_chunk_header::chunk_flags::epoch_type;
+    using heap_index_type = heap_registry::heap_index_type;
+
+    static constexpr size_type no_rescan =
+            std::numeric_limits<size_type>::max();
 
 public:
-    deferred_heap_impl();
+    explicit deferred_heap_impl(std::pmr::memory_resource*);
 
     ~deferred_heap_impl();
 
@@ -36,19 +60,149 @@ public:
     objects_number get_root_objects_number() const;
     bytes_number get_total_bytes() const;
 
+    size_type get_mark_stack_limit() const;
+    void set_mark_stack_limit(size_type);
+
+    size_type get_mark_threads_number() const;
+    void set_mark_threads_number(size_type);
+
+    bool is_mark_bitmap_enabled() const;
+    void set_mark_bitmap_enabled(bool);
+
+    bool is_eager_reclamation_enabled() const;
+    void set_eager_reclamation_enabled(bool);
+
+    bool is_generational_enabled() const;
+    void set_generational_enabled(bool);
+
+    bool is_lazy_sweep_enabled() const;
+    void set_lazy_sweep_enabled(bool);
+    bool sweep_step(std::chrono::nanoseconds budget);
+    chunks_number get_unswept_chunks_number() const;
+
+    size_type get_finalizer_threads_number() const;
+    void set_finalizer_threads_number(size_type);
+
     std::tuple<chunks_number, objects_number, bytes_number>
     mark_and_swipe();
+    std::tuple<chunks_number, objects_number, bytes_number>
+    mark_and_swipe_all();
 
+    void begin_collection();
+    bool step(std::chrono::nanoseconds budget);
+    std::tuple<chunks_number, objects_number, bytes_number>
+    finish_collection();
+    bool is_collecting() const;
+
+    /// Pool small chunks allocated by make_deferred are taken from.
+    slab_pool& get_slab_pool() noexcept;
+    /// Resource slab pools of heap and its threads take memory from.
+    std::pmr::memory_resource* get_memory_resource() const noexcept;
+
+    /// Allocation context of calling thread, created on first call.
+    thread_allocation_context& get_thread_context();
+
+    heap_index_type get_heap_index() const noexcept;
+
+    /// Register chunk allocated by heap allocator, allocation
+    /// pays for lazy sweep and releases memory of finalized chunks.
     void receive_chunk(chunk_unique_ptr&&);
+    /// Register chunk moved from thread context. Thread contexts
+    /// are locked meanwhile, so no memory is released.
+    void adopt_chunk(chunk_unique_ptr&&);
+    /// Called by allocator for chunk it has destroyed.
+    void reclaim_chunk(memory_chunk_header&) noexcept;
+
+    /// Called by root_ptr when chunk of this heap becomes root
+    /// or stops being one.
+    void add_root(memory_chunk_header&);
+    void remove_root(memory_chunk_header&) noexcept;
+
+    /// Called by write barrier for stores of chunks of this heap.
+    void on_store(memory_chunk_header&,
+                  memory_chunk_header* const* slot) noexcept;
+
+private:
+    struct old_chunk_range
+    {
+        const unsigned char* begin;
+        const unsigned char* end;
+        memory_chunk_header* chunk;
+
+    }; // struct old_chunk_range
+
+    /// Slot inside old chunk young chunk was stored into.
+    using remembered_slot = memory_chunk_header* const*;
 
 private:
-    void clear_all_visited();
+    void shade(memory_chunk_header&) noexcept;
+    void update_write_barrier() noexcept;
+    void check_write_barrier_index() const;
+    void move_thread_chunks();
+    bool has_root_index() const noexcept;
+    template <typename F>
+    void for_each_root(F&&) const;
+    void prepare_marking();
     void visit_mark_all();
+    bool visit_mark_all_parallel();
+    void recover_mark_stack_overflow(visitor&);
+    void rescan_chunk(memory_chunk_header&, visitor&);
+    void drain_mark_stack(visitor&);
+    bool mark_incrementally(visitor&, size_type work);
+    size_type move_marked_to_front(size_type first);
+    std::tuple<chunks_number, objects_number, bytes_number>
+    swipe_all_non_marked(size_type first);
+    void queue_unswept(size_type first) noexcept;
+    void sweep_chunks(size_type number) noexcept;
+    void finish_sweep() noexcept;
+    void release_finalized_chunks() noexcept;
+    void release_empty_pages() noexcept;
+    bool is_major_collection_due() const noexcept;
     std::tuple<chunks_number, objects_number, bytes_number>
-    swipe_all_non_marked();
+    mark_and_swipe_young();
+    void visit_mark_young();
+    memory_chunk_header* find_old_chunk(const void*) const noexcept;
+    void promote_young_chunks();
 
 private:
-    std::vector<chunk_unique_ptr> m_all_chunks;
+    // declared first, so that they outlive chunks allocated from them
+    slab_pool m_slab_pool;
+    mutable std::mutex m_thread_contexts_mutex;
+    std::unordered_map<std::thread::id,
+                       std::unique_ptr<thread_allocation_context>>
+            m_thread_contexts;
+    chunk_registry m_all_chunks;
+    // unreachable chunks waiting for lazy sweep
+    chunk_registry m_unswept_chunks;
+    bool m_lazy_sweep;
+    std::unique_ptr<finalizer_pool> m_finalizers;
+    mark_stack m_mark_stack;
+    parallel_marker m_parallel_marker;
+    epoch_type m_epoch;
+    mark_bitmap m_mark_bitmap;
+    bool m_mark_bitmap_enabled;
+    bool m_eager_reclamation;
+    bool m_collecting;
+    /// Next chunk rescanned by incremental collection
+    /// recovering from mark stack overflow.
+    size_type m_rescan_position;
+    const heap_index_type m_heap_index;
+    bool m_generational;
+    bool m_major_collection_needed;
+    size_type m_old_chunks_number;
+    size_type m_major_old_chunks_number;
+    std::vector<old_chunk_range> m_old_chunks_index;
+    std::vector<memory_chunk_header*> m_old_chunks_to_rescan;
+    // stores are recorded by every thread allocating from heap
+    mutable std::mutex m_remembered_slots_mutex;
+    std::unordered_set<remembered_slot> m_remembered_slots;
+    // root_ptr of any thread allocating from heap may change roots
+    mutable std::mutex m_root_chunks_mutex;
+    std::unordered_set<memory_chunk_header*> m_root_chunks;
+    // written only by thread using the heap, read by any thread
+    std::atomic<chunks_number> m_chunks_number;
+    std::atomic<objects_number> m_objects_number;
+    std::atomic<bytes_number> m_total_bytes;
 
 }; // class deferred_heap::impl
 
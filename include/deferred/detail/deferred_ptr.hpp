@@ -2,9 +2,17 @@
 
 #include <cstddef>
 #include <cassert>
+#include <exception>
 #include <functional>
 #include <type_traits>
 
+#ifdef DEF_ENABLE_WRITE_BARRIER
+#include "write_barrier.hpp"
+#endif // DEF_ENABLE_WRITE_BARRIER
+
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+#include "memory_chunk_header.hpp"
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
 
 namespace def
 {
@@ -25,6 +33,11 @@ class visitor;
  * be automatically used be deferred heap for tracing reachability of objects.
  * Memory in deferred heap is actually owned only by heap itself.
  * This class is to be used as ordinary pointer.
+ * When library is built with single word pointers
+ * (DEFERRED_HEAP_SINGLE_WORD_PTR cmake option) only chunk header
+ * is stored, object immediately follows it. Conversion to base
+ * is then allowed only if base subobject has the same address,
+ * other conversions terminate program.
  * @tparam T type of referred object
  */
 template <typename T>
@@ -40,53 +53,103 @@ public:
 
     /// Default constructor, creates an empty deferred_ptr.
     constexpr deferred_ptr() noexcept
-    : m_ptr{nullptr}
-    , m_header{nullptr}
+    : m_header{nullptr}
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+    , m_ptr{nullptr}
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
     { }
 
     /// Creates an empty deferred_ptr.
     constexpr deferred_ptr(nullptr_t) noexcept
-    : m_ptr{nullptr}
-    , m_header{nullptr}
+    : m_header{nullptr}
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+    , m_ptr{nullptr}
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
     { }
 
+#ifdef DEF_ENABLE_WRITE_BARRIER
+    /// Copy constructor. Shade referred object if heap is collecting.
+    deferred_ptr(const deferred_ptr<T>& other) noexcept
+    : m_header{other.m_header}
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+    , m_ptr{other.m_ptr}
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+    {
+        detail::write_barrier::on_store(m_header, &m_header);
+    }
+#else
     /// Copy constructor. Do simple copy as deferred_ptr doesn't own an object.
     deferred_ptr(const deferred_ptr<T>&) = default;
+#endif // DEF_ENABLE_WRITE_BARRIER
 
     /// Converting constructor from another type.
     template<typename Up>
     deferred_ptr(const deferred_ptr<Up>& other) noexcept
-    : m_ptr{other.m_ptr}
-    , m_header{other.m_header}
-    { }
+    : m_header{other.m_header}
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+    , m_ptr{other.m_ptr}
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+    {
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+        check_conversion(other.get());
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+#ifdef DEF_ENABLE_WRITE_BARRIER
+        detail::write_barrier::on_store(m_header, &m_header);
+#endif // DEF_ENABLE_WRITE_BARRIER
+    }
 
     /// Destructor, do nothing as deferred_ptr doesn't own an object.
     ~deferred_ptr() noexcept
     {
-        m_ptr = nullptr;
         m_header = nullptr;
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+        m_ptr = nullptr;
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
     }
 
     // Assignment.
 
+#ifdef DEF_ENABLE_WRITE_BARRIER
+    /// Copy assignment operator.
+    /// Shade referred object if heap is collecting.
+    deferred_ptr& operator=(const deferred_ptr<T>& other) noexcept
+    {
+        m_header = other.m_header;
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+        m_ptr = other.m_ptr;
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+        detail::write_barrier::on_store(m_header, &m_header);
+        return *this;
+    }
+#else
     /// Copy assignment operator.
     /// Do simple copy as deferred_ptr doesn't own an object.
     deferred_ptr& operator=(const deferred_ptr<T>&) = default;
+#endif // DEF_ENABLE_WRITE_BARRIER
 
     /// Assignment from another type.
     template<typename Up>
     deferred_ptr& operator=(const deferred_ptr<Up>& other) noexcept
     {
-        m_ptr = other.m_ptr;
         m_header = other.m_header;
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+        check_conversion(other.get());
+#else
+        m_ptr = other.m_ptr;
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+#ifdef DEF_ENABLE_WRITE_BARRIER
+        detail::write_barrier::on_store(m_header, &m_header);
+#endif // DEF_ENABLE_WRITE_BARRIER
         return *this;
     }
 
     /// Reset the deferred_ptr to empty.
     deferred_ptr& operator=(nullptr_t) noexcept
     {
-        m_ptr = nullptr;
         m_header = nullptr;
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+        m_ptr = nullptr;
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
         return *this;
     }
 
@@ -96,34 +159,38 @@ public:
     typename std::add_lvalue_reference<T>::type
     operator*() const noexcept
     {
-        assert(m_ptr);
-        return *((T*)m_ptr);
+        assert(get());
+        return *((T*)get());
     }
 
     /// Return the stored pointer.
     T* operator->() const noexcept
     {
-        assert(m_ptr);
-        return m_ptr;
+        assert(get());
+        return get();
     }
 
     template <typename C = T>
     std::enable_if_t<std::is_array_v<C>, element_type&>
     operator[](std::ptrdiff_t idx) const
     {
-        return m_ptr[idx];
+        return get()[idx];
     }
 
     /// Return the stored pointer.
     pointer get() const noexcept
     {
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+        return get_object(m_header);
+#else
         return m_ptr;
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
     }
 
     /// Return true if the stored pointer is not null.
     explicit operator bool() const noexcept
     {
-        return m_ptr != nullptr && m_header != nullptr;
+        return m_header != nullptr;
     }
 
 protected:
@@ -135,22 +202,58 @@ protected:
 private:
     /// Constructor to be used only by deferred allocator.
     explicit deferred_ptr(detail::memory_chunk_header* header,
-                          pointer ptr) noexcept
-    : m_ptr{ptr}
-    , m_header{header}
+                          [[maybe_unused]] pointer ptr) noexcept
+    : m_header{header}
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+    , m_ptr{ptr}
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
     {
         // both nullptr, or both have value
-        assert((m_ptr == nullptr) == (m_header == nullptr));
+        assert((ptr == nullptr) == (m_header == nullptr));
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+        assert(ptr == get_object(m_header));
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
     }
 
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+    /// First object of chunk, it immediately follows header.
+    static pointer get_object(detail::memory_chunk_header* header) noexcept
+    {
+        if (header == nullptr)
+            return nullptr;
+        return reinterpret_cast<pointer>(
+                reinterpret_cast<unsigned char*>(header)
+                + sizeof(detail::memory_chunk_header));
+    }
+
+    /// Address of converted object can not be kept, so conversion
+    /// should not change it. Conversion known to change it does not
+    /// compile, otherwise it is checked in every build and program
+    /// is terminated instead of pointing to wrong object.
+    template <typename Up>
+    static void check_conversion(Up* ptr) noexcept
+    {
+        static_assert(!std::is_polymorphic_v<Up>
+                      || std::is_polymorphic_v<element_type>,
+                      "conversion moves object address, "
+                      "it is not supported by single word deferred_ptr");
+        const pointer converted = ptr;
+        if (static_cast<const void*>(converted) !=
+            static_cast<const void*>(ptr))
+            std::terminate();
+    }
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+
 private:
     template <typename U>
     friend class deferred_ptr;
     friend class simple_allocator;
     friend class visitor;
 
-    pointer                         m_ptr;
     detail::memory_chunk_header*    m_header;
+#ifndef DEF_SINGLE_WORD_DEFERRED_PTR
+    pointer                         m_ptr;
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
 
 }; // class deferred_ptr<T>
 
@@ -8,14 +8,24 @@
 #include "root_ptr.hpp"
 #include "memory_chunk_header.hpp"
 #include "deferred_type_helper_impl.hpp"
+#include "slab_allocator.hpp"
 
 namespace def::detail
 {
 
 class deferred_heap_impl;
+class thread_allocation_context;
 
+/// Chunk is kept by thread context, if it is given.
 void deferred_heap_impl_move_memory_to_deferred_heap(
-        deferred_heap_impl&, memory_chunk_header*) noexcept(false);
+        deferred_heap_impl&, thread_allocation_context*,
+        memory_chunk_header*) noexcept(false);
+
+void deferred_heap_impl_reclaim_destroyed_memory(
+        deferred_heap_impl&, memory_chunk_header*) noexcept;
+
+slab_pool& deferred_heap_impl_get_slab_pool(
+        deferred_heap_impl&, thread_allocation_context*) noexcept;
 
 template <typename T>
 struct construct_helper
@@ -24,11 +34,13 @@ struct construct_helper
     static
     std::pair<memory_chunk_header*, T*>
     construct(unsigned char* ptr, const std::size_t n_objects,
-              const bool is_array, Allocator allocator, Args&&... args)
+              const bool is_array, const bool in_typed_page,
+              Allocator allocator, Args&&... args)
     {
         assert(ptr != nullptr);
+        using layout = chunk_layout<T, Allocator>;
         auto* offset_ptr = reinterpret_cast<T*>(
-                ptr + sizeof(detail::memory_chunk_header) + sizeof(Allocator));
+                ptr + layout::get_prefix_bytes(is_array, in_typed_page));
         auto* current_ptr = offset_ptr;
         std::size_t current_obj = 0;
         try
@@ -40,7 +52,9 @@ struct construct_helper
                                 allocator, current_ptr,
                                 std::forward<Args>(args)...);
             }
-            auto* control_ptr = construct_control(ptr, is_array, allocator);
+            auto* control_ptr = construct_control(
+                    reinterpret_cast<unsigned char*>(offset_ptr),
+                    is_array, in_typed_page, allocator);
             return {control_ptr, offset_ptr};
         }
         catch(...)
@@ -60,10 +74,11 @@ private:
     template<typename Allocator, typename... Args>
     static
     memory_chunk_header*
-    construct_control(unsigned char* ptr, const bool is_array,
-                      Allocator& allocator)
+    construct_control(unsigned char* object_ptr, const bool is_array,
+                      const bool in_typed_page, Allocator& allocator)
     {
-        assert(ptr != nullptr);
+        assert(object_ptr != nullptr);
+        using layout = chunk_layout<T, Allocator>;
         using control_allocator = typename std::allocator_traits<Allocator>::
                 template rebind_alloc<memory_chunk_header>;
         using original_alloc_allocator =
@@ -72,16 +87,20 @@ private:
 
         auto allocator_control = control_allocator{allocator};
         auto* control_ptr = reinterpret_cast<memory_chunk_header*>(
-                ptr + sizeof(Allocator));
+                object_ptr - sizeof(memory_chunk_header));
         auto& helper = type_helper_impl<T, Allocator>::instance();
         std::allocator_traits<control_allocator>::
                 template construct<memory_chunk_header>(
                         allocator_control, control_ptr,
-                        helper, is_array);
+                        helper, is_array, in_typed_page);
+        if (!layout::stores_allocator || in_typed_page)
+            return control_ptr;
         try
         {
             auto allocator_alloc = original_alloc_allocator{allocator};
-            auto* alloc_ptr = reinterpret_cast<Allocator*>(ptr);
+            auto* alloc_ptr = reinterpret_cast<Allocator*>(
+                    reinterpret_cast<unsigned char*>(
+                            control_ptr->get_allocator_start()));
             std::allocator_traits<original_alloc_allocator>::
                     template construct<Allocator>(allocator_alloc, alloc_ptr,
                             allocator);
@@ -102,35 +121,58 @@ struct simple_allocator_helper
 {
     template <typename Allocator, typename... Args>
     static std::pair<memory_chunk_header*, T*>
-    allocate_deferred(deferred_heap_impl& heap, const Allocator& allocator,
-                      Args&&... args)
+    allocate_deferred(const Allocator& allocator, Args&&... args)
     {
         using bytes_allocator = typename std::allocator_traits<Allocator>::
                 template rebind_alloc<unsigned char>;
+        using layout = chunk_layout<T, Allocator>;
+        constexpr bool in_typed_page = layout::uses_typed_page;
         constexpr std::size_t allocation_size =
-                sizeof(T) + sizeof(memory_chunk_header) + sizeof(Allocator);
+                sizeof(T) + layout::get_prefix_bytes(false, in_typed_page);
 
         auto allocator_raw = bytes_allocator{allocator};
-        auto* raw_pointer = std::allocator_traits<bytes_allocator>::allocate(
-                allocator_raw, allocation_size);
+        unsigned char* raw_pointer = nullptr;
+        if constexpr (layout::is_over_aligned)
+        {
+            raw_pointer = allocator_raw.allocate_aligned(
+                    allocation_size, layout::alignment);
+        }
+        else if constexpr (is_slab_allocator<Allocator>::value)
+        {
+            raw_pointer = allocator_raw.allocate_typed(
+                    type_helper_impl<T, Allocator>::instance(),
+                    allocation_size);
+        }
+        else
+        {
+            raw_pointer = std::allocator_traits<bytes_allocator>::allocate(
+                    allocator_raw, allocation_size);
+        }
         assert(raw_pointer != nullptr);
         try
         {
             auto [control_ptr, offset_ptr] = construct_helper<T>::construct(
-                    &(*raw_pointer), 1, false,
+                    &(*raw_pointer), 1, false, in_typed_page,
                     allocator, std::forward<Args>(args)...);
             assert(control_ptr != nullptr);
             assert(offset_ptr != nullptr);
             raw_pointer = nullptr;
-            deferred_heap_impl_move_memory_to_deferred_heap(heap, control_ptr);
             return {control_ptr, offset_ptr};
         }
         catch(...)
         {
             if (raw_pointer != nullptr)
             {
-                std::allocator_traits<bytes_allocator>::deallocate(
-                        allocator_raw, raw_pointer, allocation_size);
+                if constexpr (layout::is_over_aligned)
+                {
+                    allocator_raw.deallocate_aligned(
+                            raw_pointer, allocation_size, layout::alignment);
+                }
+                else
+                {
+                    std::allocator_traits<bytes_allocator>::deallocate(
+                            allocator_raw, raw_pointer, allocation_size);
+                }
             }
             throw;
         }
@@ -143,58 +185,76 @@ struct simple_allocator_helper<T[]>
 {
     template <typename Allocator, typename... Args>
     static std::pair<memory_chunk_header*, T*>
-    allocate_deferred(deferred_heap_impl& heap, const Allocator& allocator,
+    allocate_deferred(const Allocator& allocator,
                       std::size_t n_objects, const T& u)
     {
-        return allocate_deferred_impl(heap, allocator, n_objects, u);
+        return allocate_deferred_impl(allocator, n_objects, u);
     }
 
     template <typename Allocator, typename... Args>
     static std::pair<memory_chunk_header*, T*>
-    allocate_deferred(deferred_heap_impl& heap, const Allocator& allocator,
+    allocate_deferred(const Allocator& allocator,
                       std::size_t n_objects)
     {
-        return allocate_deferred_impl(heap, allocator, n_objects);
+        return allocate_deferred_impl(allocator, n_objects);
     }
 
 private:
     template <typename Allocator, typename... Args>
     static std::pair<memory_chunk_header*, T*>
-    allocate_deferred_impl(deferred_heap_impl& heap, const Allocator& allocator,
+    allocate_deferred_impl(const Allocator& allocator,
                            std::size_t n_objects, Args&&... args)
     {
         using bytes_allocator = typename std::allocator_traits<Allocator>::
                 template rebind_alloc<unsigned char>;
+        using layout = chunk_layout<T, Allocator>;
+        constexpr std::size_t prefix_size =
+                layout::get_prefix_bytes(true, false);
         const std::size_t allocation_size =
-                sizeof(T) * n_objects +
-                sizeof(memory_chunk_header) +
-                sizeof(memory_chunk_header::size_t) +
-                sizeof(Allocator);
+                sizeof(T) * n_objects + prefix_size;
 
         auto allocator_raw = bytes_allocator{allocator};
-        auto* raw_pointer = std::allocator_traits<bytes_allocator>::allocate(
-                allocator_raw, allocation_size);
+        unsigned char* raw_pointer = nullptr;
+        if constexpr (layout::is_over_aligned)
+        {
+            raw_pointer = allocator_raw.allocate_aligned(
+                    allocation_size, layout::alignment);
+        }
+        else
+        {
+            raw_pointer = std::allocator_traits<bytes_allocator>::allocate(
+                    allocator_raw, allocation_size);
+        }
         assert(raw_pointer != nullptr);
-        (*reinterpret_cast<memory_chunk_header::size_t*>(raw_pointer)) =
-                n_objects;
+        (*reinterpret_cast<memory_chunk_header::size_t*>(
+                &(*raw_pointer) + prefix_size - sizeof(memory_chunk_header)
+                - layout::bytes_per_allocator
+                - sizeof(memory_chunk_header::size_t))) = n_objects;
         try
         {
             auto [control_ptr, offset_ptr] = construct_helper<T>::construct(
-                    &(*raw_pointer) + sizeof(memory_chunk_header::size_t),
-                    n_objects, true,
+                    &(*raw_pointer),
+                    n_objects, true, false,
                     allocator, std::forward<Args>(args)...);
             assert(control_ptr != nullptr);
             assert(offset_ptr != nullptr);
             raw_pointer = nullptr;
-            deferred_heap_impl_move_memory_to_deferred_heap(heap, control_ptr);
             return {control_ptr, offset_ptr};
         }
         catch(...)
         {
             if (raw_pointer != nullptr)
             {
-                std::allocator_traits<bytes_allocator>::deallocate(
-                        allocator_raw, raw_pointer, allocation_size);
+                if constexpr (layout::is_over_aligned)
+                {
+                    allocator_raw.deallocate_aligned(
+                            raw_pointer, allocation_size, layout::alignment);
+                }
+                else
+                {
+                    std::allocator_traits<bytes_allocator>::deallocate(
+                            allocator_raw, raw_pointer, allocation_size);
+                }
             }
             throw;
         }
@@ -207,19 +267,18 @@ struct simple_allocator_helper<T[N]>
 {
     template <typename Allocator, typename... Args>
     static std::pair<memory_chunk_header*, T*>
-    allocate_deferred(deferred_heap_impl& heap, const Allocator& allocator,
-                      const T& u)
+    allocate_deferred(const Allocator& allocator, const T& u)
     {
         return simple_allocator_helper<T[]>::allocate_deferred(
-                heap, allocator, N, u);
+                allocator, N, u);
     }
 
     template <typename Allocator, typename... Args>
     static std::pair<memory_chunk_header*, T*>
-    allocate_deferred(deferred_heap_impl& heap, const Allocator& allocator)
+    allocate_deferred(const Allocator& allocator)
     {
         return simple_allocator_helper<T[]>::allocate_deferred(
-                heap, allocator, N);
+                allocator, N);
     }
 
 }; // simple_allocator_helper<T[N]>
@@ -234,12 +293,18 @@ class deferred_heap;
 class simple_allocator
 {
 public:
+    /// Allocate object(s) from slab pool of heap,
+    /// or of thread for allocator of thread.
     template <typename T, typename... Args>
     deferred_ptr<T> make_deferred(Args&&... args)
     {
         using clean_t = std::remove_extent_t<T>;
-        return allocate_deferred<T, std::allocator<clean_t>, Args...>(
-                std::allocator<clean_t>{}, std::forward<Args>(args)...);
+        using allocator_type = detail::slab_allocator<clean_t>;
+        assert(m_heap);
+        auto allocator = allocator_type{
+                detail::deferred_heap_impl_get_slab_pool(*m_heap, m_context)};
+        return allocate_deferred<T, allocator_type, Args...>(
+                allocator, std::forward<Args>(args)...);
     }
 
     template <typename T, typename Allocator, typename... Args>
@@ -249,7 +314,10 @@ public:
         assert(m_heap);
         const auto [header, ptr] = detail::simple_allocator_helper<T>::
                 template allocate_deferred<Allocator, Args...>(
-                        *m_heap, allocator, std::forward<Args>(args)...);
+                        allocator, std::forward<Args>(args)...);
+        // chunk is released if heap fails to take it
+        detail::deferred_heap_impl_move_memory_to_deferred_heap(
+                *m_heap, m_context, header);
         return deferred_ptr<T>{header, ptr};
     }
 
@@ -272,26 +340,39 @@ public:
     }
 
 private:
-    explicit simple_allocator(detail::deferred_heap_impl& heap)
+    explicit simple_allocator(detail::deferred_heap_impl& heap,
+            detail::thread_allocation_context* context = nullptr)
     : m_heap{&heap}
+    , m_context{context}
     { }
 
     template <typename P>
     void destroy_deferred_impl(P& def_ptr)
     {
         detail::memory_chunk_header* header = def_ptr.get_header();
-        if (header && !header->flags.is_destroyed())
+        const bool destroyed_now = header && !header->flags.is_destroyed();
+        if (destroyed_now)
         {
-            header->helper.destroy(*header);
+            header->get_helper().destroy(*header);
             assert(header->flags.is_destroyed());
         }
+        // releases root reference, before heap checks for one
         def_ptr = nullptr;
+        // heap registry is not touched by threads allocating,
+        // their chunks are left to collection
+        if (destroyed_now && m_context == nullptr)
+        {
+            assert(m_heap);
+            detail::deferred_heap_impl_reclaim_destroyed_memory(
+                    *m_heap, header);
+        }
     }
 
 private:
     friend class deferred_heap;
 
     detail::deferred_heap_impl* m_heap;
+    detail::thread_allocation_context* m_context;
 
 }; // simple_allocator
 
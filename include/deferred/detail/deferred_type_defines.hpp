@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <type_traits>
 
 #include "identity.hpp"
@@ -26,6 +27,12 @@ static constexpr \
                 __DEF_DETAIL_CURRENT_COUNTER_VALUE(\
                         __deferred_detail_owner_class)>) \
 {return {};} \
+template <typename __deferred_detail_class = __deferred_detail_owner_class> \
+static constexpr std::size_t __deferred_detail_get_member_offset(\
+        std::integral_constant<unsigned int, \
+                __DEF_DETAIL_CURRENT_COUNTER_VALUE(\
+                        __deferred_detail_owner_class)>) \
+{return offsetof(__deferred_detail_class, __name);} \
 __DEF_DETAIL_INCREMENT_COUNTER_VALUE(__deferred_detail_owner_class) \
 using __deferred_detail_require_semicolon_##__name = decltype(0)
 
@@ -1,27 +1,58 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <typeinfo>
 
+namespace def
+{
+
+class visitor;
+
+} // namespace def
+
 namespace def::detail
 {
 
 struct memory_chunk_header;
 
 /// Base for helper for deferred-enabled type.
+/// Every helper is registered in global table,
+/// so chunk header keeps only its index.
 class type_helper
 {
+public:
+    using type_index_type = uint16_t;
+
+    static constexpr std::size_t max_types_number = 1u << 16u;
+
 public:
     explicit type_helper(const std::type_info& info,
                          std::size_t bytes_object,
-                         std::size_t bytes_allocator)
+                         std::size_t bytes_allocator,
+                         std::size_t alignment_object,
+                         bool pointers_in_place,
+                         bool leaf,
+                         bool trivially_destructible)
     : type_info{info}
+    , type_index{register_type_helper(*this)}
     , bytes_per_object{bytes_object}
     , bytes_per_allocator{bytes_allocator}
+    , alignment{alignment_object}
+    , keeps_pointers_in_place{pointers_in_place}
+    , is_leaf{leaf}
+    , is_trivially_destructible{trivially_destructible}
+    , m_pointer_offsets{nullptr}
+    , m_pointers_number{0u}
     { }
 
+    /// Helper registered with given index.
+    static const type_helper& get_type_helper(type_index_type) noexcept;
+
     /// Traverse through deferred pointers known to
-    /// deferred-enabled type and recursively mark them as visited.
-    virtual void mark_recursive(memory_chunk_header&) const = 0;
+    /// deferred-enabled type and pass them to visitor.
+    /// Pointers at known offsets are read without virtual call.
+    void visit_children(memory_chunk_header&, visitor&) const;
 
     /// Run destructor(s).
     void destroy(memory_chunk_header&) const;
@@ -29,13 +60,53 @@ public:
     /// Free memory.
     virtual void deallocate(memory_chunk_header*) const = 0;
 
+    /// Run destructors of several chunks of this type,
+    /// chunks that are already destroyed are skipped.
+    virtual void destroy_many(memory_chunk_header* const*,
+                              std::size_t number) const = 0;
+    /// Free memory of several destroyed chunks of this type.
+    virtual void deallocate_many(memory_chunk_header* const*,
+                                 std::size_t number) const = 0;
+
+protected:
+    /// Let visit_children read deferred pointers at given offsets
+    /// instead of calling visit_children_impl.
+    void set_pointer_offsets(const std::size_t* offsets,
+                             std::size_t number) noexcept
+    {
+        m_pointer_offsets = offsets;
+        m_pointers_number = number;
+    }
+
 private:
+    /// Throw std::length_error if there is no free index left.
+    static type_index_type register_type_helper(const type_helper&);
+
+    virtual void visit_children_impl(memory_chunk_header&,
+                                     visitor&) const = 0;
     virtual void destroy_impl(memory_chunk_header&) const = 0;
 
 public:
     const std::type_info& type_info;
+    /// Sequential number of type helper, starting with 0.
+    const type_index_type type_index;
     const std::size_t bytes_per_object;
     const std::size_t bytes_per_allocator;
+    const std::size_t alignment;
+    /// All deferred pointers of type are stored inside its objects.
+    const bool keeps_pointers_in_place;
+    /// Type holds no deferred pointers, chunk is marked without tracing.
+    const bool is_leaf;
+    /// Destroying objects does nothing, so chunks are released
+    /// without destroy_many and are deallocated not being marked
+    /// as destroyed.
+    const bool is_trivially_destructible;
+
+private:
+    /// Offsets of header pointers of all deferred pointers of object,
+    /// nullptr if type is traversed by visit_children_impl.
+    const std::size_t* m_pointer_offsets;
+    std::size_t m_pointers_number;
 
 }; // class type_helper
 
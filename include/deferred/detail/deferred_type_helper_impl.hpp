@@ -2,62 +2,203 @@
 
 #include "deferred_type_helper.hpp"
 
-#include <vector>
+#include <array>
 #include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <cassert>
 
 #include "memory_chunk_header.hpp"
+#include "slab_allocator.hpp"
 #include "visitor.hpp"
 #include "deferred_type_traverse_helper.hpp"
 
 namespace def::detail
 {
 
+template <typename Allocator, typename T, typename = void>
+struct has_allocator_destroy : std::false_type
+{ }; // struct has_allocator_destroy<Allocator, T, Enable>
+
+template <typename Allocator, typename T>
+struct has_allocator_destroy<Allocator, T, std::void_t<
+        decltype(std::declval<Allocator&>().destroy(std::declval<T*>()))>>
+    : std::true_type
+{ }; // struct has_allocator_destroy<Allocator, T>
+
+template <typename Allocator>
+struct is_std_allocator : std::false_type
+{ }; // struct is_std_allocator<Allocator>
+
+template <typename T>
+struct is_std_allocator<std::allocator<T>> : std::true_type
+{ }; // struct is_std_allocator<std::allocator<T>>
+
+/// Objects of type T allocated with Allocator need no destruction:
+/// destructor is trivial and allocator does not replace it.
+template <typename T, typename Allocator>
+constexpr bool is_trivially_destroyed_v =
+        std::is_trivially_destructible_v<T>
+        && std::disjunction_v<is_std_allocator<Allocator>,
+               std::negation<has_allocator_destroy<Allocator, T>>>;
+
+/// Sizes and alignment of memory chunk parts for type T
+/// allocated with Allocator.
+template <typename T, typename Allocator>
+struct chunk_layout
+{
+    static constexpr std::size_t alignment = std::max({
+            alignof(T), alignof(memory_chunk_header), alignof(Allocator)});
+
+    /// Stateless allocator is not copied into chunk,
+    /// new instance is created whenever it is needed.
+    static constexpr bool stores_allocator =
+            !std::allocator_traits<Allocator>::is_always_equal::value
+            || !std::is_default_constructible_v<Allocator>;
+
+    static constexpr std::size_t bytes_per_allocator = stores_allocator
+            ? (sizeof(Allocator) + alignof(memory_chunk_header) - 1u)
+              / alignof(memory_chunk_header) * alignof(memory_chunk_header)
+            : 0u;
+
+    static constexpr std::size_t get_prefix_bytes(bool is_array,
+                                                  bool in_typed_page) noexcept
+    {
+        return memory_chunk_header::get_prefix_bytes(
+                bytes_per_allocator, alignment, is_array, in_typed_page);
+    }
+
+    /// Slab pool aligns slots and blocks to slot granularity only,
+    /// chunks needing more are taken from its upstream resource.
+    static constexpr bool is_over_aligned =
+            is_slab_allocator<Allocator>::value
+            && alignment > slab_pool::slot_granularity;
+
+    /// Single objects allocated from slab pool are kept in typed pages,
+    /// if chunk fits into slot and slot alignment is enough.
+    /// Such chunks do not keep allocator, it refers to pool of page.
+    static constexpr bool uses_typed_page =
+            is_slab_allocator<Allocator>::value
+            && alignment <= slab_pool::slot_granularity
+            && sizeof(T) + get_prefix_bytes(false, true)
+               <= slab_pool::max_slot_size;
+
+}; // struct chunk_layout<T, Allocator>
+
 template <typename T, typename Allocator>
 class type_helper_impl : private type_helper
 {
 public:
     using type      = T;
     using allocator = Allocator;
+    using layout    = chunk_layout<T, Allocator>;
+    using traverse  = object_traverse_helper<T>;
+
+private:
+    static constexpr bool has_pointer_offsets =
+            traverse::has_pointer_offsets() && !traverse::is_leaf();
+    static constexpr std::size_t pointers_number =
+            has_pointer_offsets ? traverse::get_pointers_number() : 0u;
 
 public:
     explicit type_helper_impl()
-    : type_helper{typeid(type), sizeof(type), sizeof(allocator)}
-    { }
+    : type_helper{typeid(type), sizeof(type),
+                  layout::bytes_per_allocator, layout::alignment,
+                  traverse::is_traversed_in_place(), traverse::is_leaf(),
+                  is_trivially_destroyed_v<type, allocator>}
+    , m_pointer_offsets{}
+    {
+        if constexpr (has_pointer_offsets)
+        {
+            traverse::get_pointer_offsets(m_pointer_offsets.data());
+            set_pointer_offsets(m_pointer_offsets.data(), pointers_number);
+        }
+    }
 
 private:
-    void mark_recursive(memory_chunk_header& header) const override
+    void visit_children_impl(
+            [[maybe_unused]] memory_chunk_header& header,
+            [[maybe_unused]] visitor& v) const override
     {
-        auto ptr = reinterpret_cast<type*>(header.get_object_start());
-        std::vector<memory_chunk_header*> non_visited_chunks;
-        visitor v{non_visited_chunks};
-        const auto num_objects = header.get_objects_number();
-        for (memory_chunk_header::size_t i = 0; i != num_objects; ++i, ++ptr)
+        if constexpr (traverse::is_leaf())
         {
-            object_traverse_helper<T>::apply_visitor_to_all(v, *ptr);
+            return;
         }
-        for (auto*& chunk: non_visited_chunks)
+        else
         {
-            assert(chunk != nullptr);
-            if (chunk->flags.is_visited())
+            auto ptr = reinterpret_cast<type*>(header.get_object_start());
+            const auto num_objects = header.get_objects_number();
+            for (memory_chunk_header::size_t i = 0; i != num_objects;
+                    ++i, ++ptr)
             {
-                chunk = nullptr;
-                continue;
+                object_traverse_helper<T>::apply_visitor_to_all(v, *ptr);
             }
-            chunk->flags.mark_visited();
-            assert(chunk->flags.is_visited());
         }
-        for (auto* chunk: non_visited_chunks)
+    }
+
+    static bool is_allocator_stored(const memory_chunk_header& header)
+    {
+        return layout::stores_allocator && !header.flags.is_in_typed_page();
+    }
+
+    /// Allocator chunk was allocated with.
+    static allocator get_allocator(const memory_chunk_header& header)
+    {
+        if constexpr (is_slab_allocator<allocator>::value)
+        {
+            if (header.flags.is_in_typed_page())
+                return allocator{slab_pool::get_page_pool(&header)};
+        }
+        if constexpr (layout::stores_allocator)
+        {
+            return *reinterpret_cast<const allocator*>(
+                    header.get_allocator_start());
+        }
+        else
         {
-            if (chunk == nullptr)
-                continue;
-            chunk->helper.mark_recursive(*chunk);
+            return allocator{};
         }
     }
 
     void deallocate(memory_chunk_header* header) const override
     {
-        if (header == nullptr)
+        if (header != nullptr)
+            deallocate_chunk(header);
+    }
+
+    void destroy_many(
+            [[maybe_unused]] memory_chunk_header* const* headers,
+            [[maybe_unused]] std::size_t number) const override
+    {
+        if constexpr (is_trivially_destroyed_v<type, allocator>)
+        {
             return;
+        }
+        else
+        {
+            for (std::size_t i = 0; i != number; ++i)
+            {
+                auto& header = *headers[i];
+                assert(header.type_index == type_index);
+                if (header.flags.is_destroyed())
+                    continue;
+                destroy_objects(header);
+                header.flags.mark_destroyed();
+            }
+        }
+    }
+
+    void deallocate_many(memory_chunk_header* const* headers,
+                         std::size_t number) const override
+    {
+        for (std::size_t i = 0; i != number; ++i)
+            deallocate_chunk(headers[i]);
+    }
+
+    void deallocate_chunk(memory_chunk_header* header) const
+    {
+        assert((is_trivially_destroyed_v<type, allocator>
+                || header->flags.is_destroyed()));
 
         using bytes_allocator = typename std::allocator_traits<allocator>::
                 template rebind_alloc<unsigned char>;
@@ -69,38 +210,73 @@ private:
         const std::size_t allocation_size = header->get_bytes_allocated();
         auto* raw_ptr = reinterpret_cast<unsigned char*>(
                 header->get_raw_memory_start());
-        auto* alloc_ptr = reinterpret_cast<allocator*>(
-                header->get_allocator_start());
-        auto allocator_raw = bytes_allocator{*alloc_ptr};
-        auto allocator_control = control_allocator{*alloc_ptr};
-        auto allocator_original_alloc = original_alloc_allocator{*alloc_ptr};
-
-        std::allocator_traits<original_alloc_allocator>::
-                template destroy<allocator>(
-                        allocator_original_alloc, alloc_ptr);
+        const auto original_alloc = get_allocator(*header);
+        auto allocator_raw = bytes_allocator{original_alloc};
+        auto allocator_control = control_allocator{original_alloc};
+
+        if (is_allocator_stored(*header))
+        {
+            auto allocator_original_alloc =
+                    original_alloc_allocator{original_alloc};
+            std::allocator_traits<original_alloc_allocator>::
+                    template destroy<allocator>(
+                            allocator_original_alloc,
+                            reinterpret_cast<allocator*>(
+                                    header->get_allocator_start()));
+        }
+        const bool is_array = header->flags.is_array();
         std::allocator_traits<control_allocator>::
                 template destroy<memory_chunk_header>(
                         allocator_control, header);
+        if constexpr (layout::is_over_aligned)
+        {
+            allocator_raw.deallocate_aligned(
+                    raw_ptr, allocation_size, layout::alignment);
+            return;
+        }
+        else if constexpr (is_slab_allocator<allocator>::value)
+        {
+            // block of single object is kept for type by pool
+            if (!is_array)
+            {
+                allocator_raw.deallocate_typed(
+                        *this, raw_ptr, allocation_size);
+                return;
+            }
+        }
         std::allocator_traits<bytes_allocator>::deallocate(
                 allocator_raw, raw_ptr, allocation_size);
     }
 
     void destroy_impl(memory_chunk_header& header) const override
     {
-        const auto num_objects = header.get_objects_number();
-        if (num_objects == 0)
+        destroy_objects(header);
+    }
+
+    static void destroy_objects(
+            [[maybe_unused]] memory_chunk_header& header)
+    {
+        if constexpr (is_trivially_destroyed_v<type, allocator>)
+        {
             return;
+        }
+        else
+        {
+            const auto num_objects = header.get_objects_number();
+            if (num_objects == 0)
+                return;
 
-        auto& original_alloc = (*reinterpret_cast<allocator*>(
-                header.get_allocator_start()));
+            auto original_alloc = get_allocator(header);
 
-        auto* offset_ptr = reinterpret_cast<type*>(header.get_object_start());
-        offset_ptr += (num_objects - 1);
-        for (memory_chunk_header::size_t i = 0;
-                i != num_objects; ++i, --offset_ptr)
-        {
-            std::allocator_traits<allocator>::
-                    template destroy<type>(original_alloc, offset_ptr);
+            auto* offset_ptr =
+                    reinterpret_cast<type*>(header.get_object_start());
+            offset_ptr += (num_objects - 1);
+            for (memory_chunk_header::size_t i = 0;
+                    i != num_objects; ++i, --offset_ptr)
+            {
+                std::allocator_traits<allocator>::
+                        template destroy<type>(original_alloc, offset_ptr);
+            }
         }
     }
 
@@ -111,6 +287,9 @@ public:
         return object;
     }
 
+private:
+    std::array<std::size_t, pointers_number> m_pointer_offsets;
+
 }; // class type_helper
 
 } // namespace def::detail
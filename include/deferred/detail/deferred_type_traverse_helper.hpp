@@ -61,12 +61,25 @@ struct member_traverse_helper
     using member_info = decltype(T::__deferred_detail_get_member_info(tag{}));
     using member_type = std::decay_t<typename member_info::member_type>;
 
+    /// Member is deferred pointer itself, not container of them.
+    static constexpr bool is_in_place = is_deferred_ptr<member_type>::value;
+
     static void apply_visitor_member(visitor& v, object_type& object)
     {
         constexpr auto member_pointer = member_info::member_pointer;
         apply_to_member<member_type>(v, object.*member_pointer);
     }
 
+    /// Write offset of header pointer of in place member from start
+    /// of standard layout object.
+    static std::size_t* get_pointer_offset(std::size_t* offsets)
+    {
+        static_assert(is_in_place, "member is not stored in place");
+        *offsets = object_type::__deferred_detail_get_member_offset(tag{})
+                   + visitor::get_header_offset<member_type>();
+        return offsets + 1;
+    }
+
 private:
     template <typename Ptr,
               std::enable_if_t<is_deferred_ptr<Ptr>::value, int> = 0>
@@ -169,7 +182,125 @@ struct object_traverse_helper
         call_visit(v, object);
     }
 
+    /// True if all deferred pointers traversed are data members,
+    /// so that they are stored inside object itself.
+    /// Containers and user visit method may keep them elsewhere.
+    static constexpr bool is_traversed_in_place()
+    {
+        using parents = typename parent_classes<object_type>::type;
+        using tags = typename object_tags<object_type>::type;
+        return !support_visitor<object_type>::value
+               && parents_in_place(parents{})
+               && members_in_place(tags{});
+    }
+
+    /// True if deferred pointers of object are found at offsets
+    /// known for type, so that object is traced without visitor.
+    /// Offsets are taken with offsetof, so only standard layout
+    /// types have them, others are traversed.
+    static constexpr bool has_pointer_offsets()
+    {
+        using parents = typename parent_classes<object_type>::type;
+        return std::is_standard_layout_v<object_type>
+               && is_traversed_in_place() && parents_offsets(parents{});
+    }
+
+    /// Number of deferred pointers in object with pointer offsets.
+    static constexpr std::size_t get_pointers_number()
+    {
+        using parents = typename parent_classes<object_type>::type;
+        using tags = typename object_tags<object_type>::type;
+        return parents_pointers_number(parents{}) + members_number(tags{});
+    }
+
+    /// Write offsets of header pointers of all deferred pointers
+    /// of object from its start. Base class subobjects of standard
+    /// layout object share its address, so their offsets are kept.
+    static std::size_t* get_pointer_offsets(std::size_t* offsets)
+    {
+        static_assert(has_pointer_offsets(), "type has no pointer offsets");
+        using parents = typename parent_classes<object_type>::type;
+        using tags = typename object_tags<object_type>::type;
+        offsets = get_parents_offsets(offsets, parents{});
+        return get_members_offsets(offsets, tags{});
+    }
+
+    /// True if objects of type can not hold any deferred pointer,
+    /// so that chunks of them need no tracing at all.
+    static constexpr bool is_leaf()
+    {
+        using parents = typename parent_classes<object_type>::type;
+        using tags = typename object_tags<object_type>::type;
+        return !support_visitor<object_type>::value
+               && parents_leaf(parents{})
+               && members_none(tags{});
+    }
+
 private:
+    template <typename... Ts>
+    static constexpr bool parents_in_place(types_list<Ts...>)
+    {
+        return (true && ... &&
+                object_traverse_helper<Ts>::is_traversed_in_place());
+    }
+
+    template <typename... Ts>
+    static constexpr bool parents_offsets(types_list<Ts...>)
+    {
+        return (true && ... &&
+                object_traverse_helper<Ts>::has_pointer_offsets());
+    }
+
+    template <typename... Ts>
+    static constexpr std::size_t parents_pointers_number(types_list<Ts...>)
+    {
+        return (std::size_t{0} + ... +
+                object_traverse_helper<Ts>::get_pointers_number());
+    }
+
+    template <typename... Ts>
+    static constexpr std::size_t members_number(tags_list<Ts...>)
+    {
+        return sizeof...(Ts);
+    }
+
+    template <typename... Ts>
+    static std::size_t* get_parents_offsets(std::size_t* offsets,
+                                            types_list<Ts...>)
+    {
+        ((offsets = object_traverse_helper<Ts>::get_pointer_offsets(
+                offsets)), ...);
+        return offsets;
+    }
+
+    template <typename... Ts>
+    static std::size_t* get_members_offsets(std::size_t* offsets,
+                                            tags_list<Ts...>)
+    {
+        ((offsets = member_traverse_helper<object_type, Ts>
+                ::get_pointer_offset(offsets)), ...);
+        return offsets;
+    }
+
+    template <typename... Ts>
+    static constexpr bool parents_leaf(types_list<Ts...>)
+    {
+        return (true && ... && object_traverse_helper<Ts>::is_leaf());
+    }
+
+    template <typename... Ts>
+    static constexpr bool members_none(tags_list<Ts...>)
+    {
+        return sizeof...(Ts) == 0u;
+    }
+
+    template <typename... Ts>
+    static constexpr bool members_in_place(tags_list<Ts...>)
+    {
+        return (true && ... &&
+                member_traverse_helper<object_type, Ts>::is_in_place);
+    }
+
     template <typename P>
     static void apply_visitor_parent(visitor& v, object_type& object)
     {
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memory_chunk_header.hpp"
+
+namespace def::detail
+{
+
+class chunk_registry;
+
+/// Destroys unreachable chunks using background threads.
+/// Chunks are handed over in batches, destroyed chunks are kept
+/// until owner releases their memory, because slab pools
+/// memory comes from may be used by owner at the same time.
+class finalizer_pool
+{
+public:
+    using size_type = std::size_t;
+
+    static constexpr size_type batch_size = 256u;
+
+public:
+    explicit finalizer_pool(size_type threads_number);
+
+    /// Wait for all handed over chunks to be destroyed
+    /// and release their memory.
+    ~finalizer_pool();
+
+    finalizer_pool(const finalizer_pool&) = delete;
+    finalizer_pool& operator=(const finalizer_pool&) = delete;
+
+    size_type get_threads_number() const noexcept;
+
+    /// Take chunks of registry starting from given index.
+    /// Chunks that can not be handed over are destroyed
+    /// by calling thread.
+    void finalize(chunk_registry&, size_type first) noexcept;
+
+    bool has_destroyed() const noexcept;
+    /// Release memory of chunks destroyed so far.
+    void release_destroyed() noexcept;
+
+private:
+    using batch = std::vector<memory_chunk_header*>;
+
+    void work() noexcept;
+
+private:
+    std::vector<std::thread> m_threads;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_batch_available;
+    std::deque<batch> m_batches;
+    // has space for all batches in flight, so that
+    // finalizer thread never allocates
+    std::vector<batch> m_destroyed;
+    size_type m_batches_in_flight;
+    std::atomic<bool> m_has_destroyed;
+    bool m_stop;
+
+}; // class finalizer_pool
+
+} // namespace def::detail
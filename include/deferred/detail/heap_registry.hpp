@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+namespace def::detail
+{
+
+class deferred_heap_impl;
+
+/// Indices of living heaps. Chunks keep index of owning heap
+/// in header, so that root_ptr and write barrier could reach
+/// the heap knowing only chunk.
+class heap_registry
+{
+public:
+    using heap_index_type = uint8_t;
+
+public:
+    /// Reserve index for heap.
+    /// Return 0 if all indices are taken.
+    static heap_index_type acquire_index(deferred_heap_impl&) noexcept;
+    static void release_index(heap_index_type) noexcept;
+
+    /// Heap registered with index, nullptr for 0.
+    static deferred_heap_impl* get_heap(heap_index_type) noexcept;
+
+}; // class heap_registry
+
+} // namespace def::detail
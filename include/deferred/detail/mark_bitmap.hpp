@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace def::detail
+{
+
+/// Dense mark bits indexed by chunk slot in heap.
+/// Keeps marking out of chunk headers, so tracing and sweeping
+/// touch only few cache lines per thousands of chunks.
+class mark_bitmap
+{
+public:
+    using size_type = std::size_t;
+    using word_type = uint64_t;
+
+    static constexpr size_type bits_per_word = 64u;
+    static constexpr word_type full_word = ~word_type{0u};
+
+public:
+    mark_bitmap();
+
+    /// Resize to given number of bits, first marked of them set,
+    /// others cleared. Storage is kept if it is big enough.
+    void reset(size_type bits, size_type marked = 0u);
+    size_type size() const noexcept;
+
+    bool test(size_type) const noexcept;
+    void set(size_type) noexcept;
+    /// Atomically set bit, return false if it was already set.
+    bool try_set(size_type) noexcept;
+
+    word_type get_word(size_type word_index) const noexcept;
+
+private:
+    std::unique_ptr<std::atomic<word_type>[]> m_words;
+    size_type m_capacity;
+    size_type m_size;
+
+}; // class mark_bitmap
+
+} // namespace def::detail
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "memory_chunk_header.hpp"
+
+namespace def::detail
+{
+
+class mark_bitmap;
+
+/// Work list of chunks already marked as visited,
+/// deferred pointers of which are not traversed yet.
+/// Storage is kept between collections and never grows
+/// beyond max size. When stack is full, pushed chunk
+/// is left non-visited and stack is flagged as overflowed,
+/// so heap could recover by rescanning visited chunks.
+class mark_stack
+{
+public:
+    using size_type = std::size_t;
+    using epoch_type = memory_chunk_header::chunk_flags::epoch_type;
+
+    static constexpr size_type default_max_size = 1u << 16u;
+
+public:
+    explicit mark_stack(size_type max_size = default_max_size);
+
+    /// Mark chunk as visited in current epoch and push it,
+    /// if chunk was not visited yet. Leaf chunk is only marked.
+    void push(memory_chunk_header*);
+    /// Push chunk that is already marked as visited.
+    /// Return false if there is no space left.
+    bool push_visited(memory_chunk_header*);
+    memory_chunk_header* pop() noexcept;
+    bool empty() const noexcept;
+    size_type size() const noexcept;
+
+    bool is_overflowed() const noexcept;
+    void mark_overflowed() noexcept;
+    void clear_overflowed() noexcept;
+
+    size_type get_max_size() const noexcept;
+    void set_max_size(size_type);
+
+    /// Use atomic marking, so that several stacks
+    /// could be filled from different threads simultaneously.
+    void set_concurrent(bool) noexcept;
+
+    /// Heap epoch pushed chunks are marked with.
+    epoch_type get_epoch() const noexcept;
+    void set_epoch(epoch_type) noexcept;
+
+    /// Keep mark bits in given bitmap instead of chunk headers,
+    /// nullptr switches back to headers.
+    void set_bitmap(mark_bitmap*) noexcept;
+
+    bool is_visited(const memory_chunk_header&) const noexcept;
+
+private:
+    bool reserve_one();
+    bool mark_visited(memory_chunk_header&) noexcept;
+
+private:
+    std::vector<memory_chunk_header*> m_data;
+    size_type m_max_size;
+    bool m_overflowed;
+    bool m_concurrent;
+    epoch_type m_epoch;
+    mark_bitmap* m_bitmap;
+
+}; // class mark_stack
+
+} // namespace def::detail
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 
 namespace def::detail
 {
@@ -11,44 +13,72 @@ class type_helper;
 /// Util memory header for deferred heap to control memory chunks.
 /// Any memory chunk allocated with deferred allocator
 /// is allocated with bigger size to incorporate this header,
-/// copy of allocator and also number of objects
-/// in case of array allocation.
+/// copy of allocator unless it is stateless or chunk is in typed page
+/// and also number of objects in case of array allocation.
+/// Header is single word: flags, index of type helper
+/// in global table and index of chunk in heap.
 struct memory_chunk_header
 {
     using size_t = std::size_t;
+    using slot_type = uint32_t;
+    using type_index_type = uint16_t;
+
+    /// Slot of chunk not registered in heap yet.
+    static constexpr slot_type pending_slot =
+            std::numeric_limits<slot_type>::max();
 
     class chunk_flags
     {
         using underlying_type = uint16_t;
-        using root_reference_counter_type = uint16_t;
 
     public:
-        explicit chunk_flags(bool is_array) noexcept;
+        /// Chunk is visited if it was marked in current heap epoch,
+        /// so starting new collection does not touch any chunk.
+        /// Epoch 0 is never current, new chunks are not visited.
+        using epoch_type = uint8_t;
+        static constexpr epoch_type max_epoch = 7u;
+        /// Index of owning heap in write barrier heaps table,
+        /// 0 means heap has no index.
+        using heap_index_type = uint8_t;
+
+        static constexpr heap_index_type max_heap_index = 63u;
+
+    public:
+        explicit chunk_flags(bool is_array, bool in_typed_page) noexcept;
 
-        bool is_visited() const noexcept;
-        void mark_visited() noexcept;
-        void clear_visited() noexcept;
+        bool is_visited(epoch_type) const noexcept;
+        void mark_visited(epoch_type) noexcept;
+        /// Atomically mark as visited, safe to be called
+        /// from several threads tracing heap simultaneously.
+        /// Return false if chunk was already visited.
+        bool try_mark_visited(epoch_type) noexcept;
 
         bool is_array() const noexcept;
+        /// Chunk is allocated in typed page of slab pool,
+        /// its allocator is known from page.
+        bool is_in_typed_page() const noexcept;
+
+        heap_index_type get_heap_index() const noexcept;
+        void set_heap_index(heap_index_type) noexcept;
 
         bool is_destroyed() const noexcept;
         void mark_destroyed() noexcept;
 
+        /// Few root references are counted in flags,
+        /// the rest are kept in global side table.
         bool is_root() const noexcept;
         void increment_root_reference();
         void decrement_root_reference();
 
     private:
-        underlying_type m_data;
-        root_reference_counter_type m_root_references;
+        std::atomic<underlying_type> m_data;
 
     }; // class chunk_flags
 
     explicit memory_chunk_header(const type_helper& helper,
-                                 bool is_array) noexcept
-    : helper{helper}
-    , flags{is_array}
-    { }
+                                 bool is_array, bool in_typed_page) noexcept;
+
+    const type_helper& get_helper() const noexcept;
 
     size_t get_objects_number() const noexcept;
     void* get_object_start() const noexcept;
@@ -57,8 +87,26 @@ struct memory_chunk_header
 
     size_t get_bytes_allocated() const noexcept;
 
-    const type_helper& helper;
+    /// Number of bytes from raw memory start to first object.
+    /// Memory chunk layout is [number of objects (only for arrays)]
+    /// [allocator][header][objects], aligned so that header
+    /// immediately precedes first object. Allocator is omitted
+    /// if it is stateless or chunk is in typed page.
+    static constexpr size_t get_prefix_bytes(size_t bytes_allocator,
+                                             size_t alignment,
+                                             bool is_array,
+                                             bool in_typed_page) noexcept
+    {
+        const size_t bytes = sizeof(memory_chunk_header)
+                             + (in_typed_page ? 0u : bytes_allocator)
+                             + (is_array ? sizeof(size_t) : 0u);
+        return (bytes + alignment - 1u) / alignment * alignment;
+    }
+
     chunk_flags flags;
+    type_index_type type_index;
+    /// Index of chunk in heap.
+    slot_type slot;
 
 }; // struct memory_chunk_header
 
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "memory_chunk_header.hpp"
+
+namespace def::detail
+{
+
+class mark_bitmap;
+
+/// Traces heap using several threads.
+/// Every thread owns its mark stack and shares part of it
+/// when other threads run out of work, idle threads
+/// steal shared chunks from busy ones.
+class parallel_marker
+{
+public:
+    using size_type = std::size_t;
+    using epoch_type = memory_chunk_header::chunk_flags::epoch_type;
+
+public:
+    explicit parallel_marker(size_type threads_number);
+
+    ~parallel_marker();
+
+    parallel_marker(const parallel_marker&) = delete;
+    parallel_marker& operator=(const parallel_marker&) = delete;
+
+    size_type get_threads_number() const noexcept;
+    void set_threads_number(size_type);
+
+    void set_max_stack_size(size_type);
+    void set_epoch(epoch_type) noexcept;
+    void set_bitmap(mark_bitmap*) noexcept;
+
+    /// Give root chunk to one of workers, mark it as visited.
+    void add_root(memory_chunk_header*);
+
+    /// Trace everything reachable from added roots.
+    /// Return false if some chunks were left non-visited,
+    /// because mark stacks overflowed.
+    bool run();
+
+private:
+    struct worker;
+
+    void work(worker&);
+    void share_work(worker&);
+    bool take_work(worker&, worker& victim);
+    bool find_work(worker&);
+    bool wait_for_work();
+
+private:
+    std::vector<std::unique_ptr<worker>> m_workers;
+    std::atomic<size_type> m_idle_workers;
+    size_type m_next_root_worker;
+
+}; // class parallel_marker
+
+} // namespace def::detail
@@ -8,6 +8,8 @@
 namespace def
 {
 
+class simple_allocator;
+
 /**
  * @brief root_ptr is a smart pointer used with deferred heap.
  * It behaves exactly as deferred_ptr, but it will also mark objects
@@ -142,6 +144,9 @@ private:
         deferred_ptr<T>::operator=(nullptr);
     }
 
+private:
+    friend class simple_allocator;
+
 }; // class root_ptr<T>
 
 } // namespace def
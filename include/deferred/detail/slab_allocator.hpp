@@ -0,0 +1,235 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace def::detail
+{
+
+class type_helper;
+
+/// Pool of fixed size slots carved from aligned pages,
+/// one list of pages with free slots per size class.
+/// Typed pages hold chunks of single type only, type helper
+/// is kept once in page header instead of every chunk.
+/// Pages and bigger blocks are taken from upstream memory resource,
+/// few released blocks of every type are kept for reuse.
+/// Pool is owned by heap and used only by thread using the heap.
+/// Pool bound to thread allocates only for that thread, blocks
+/// freed by other threads are queued without lock and returned
+/// to their pages by owner on its next allocation.
+class slab_pool
+{
+public:
+    using size_type = std::size_t;
+
+    static constexpr size_type slot_granularity = 16u;
+    static constexpr size_type max_slot_size = 512u;
+    static constexpr size_type page_size = 64u * 1024u;
+    /// Max size of blocks kept for reuse per type.
+    static constexpr size_type max_cached_bytes = page_size;
+
+public:
+    explicit slab_pool(std::pmr::memory_resource* upstream =
+                               std::pmr::new_delete_resource()) noexcept;
+
+    slab_pool(const slab_pool&) = delete;
+    slab_pool& operator=(const slab_pool&) = delete;
+
+    ~slab_pool();
+
+    /// Make calling thread owner of pool.
+    void bind_to_thread() noexcept;
+
+    void* allocate(size_type bytes);
+    /// Memory aligned more than slot granularity
+    /// is taken from upstream resource directly.
+    void* allocate_aligned(size_type bytes, size_type alignment);
+    /// Allocate slot in page of given type, bigger block
+    /// is reused from blocks released for type if possible.
+    /// All blocks bigger than slot allocated for type
+    /// should have the same size.
+    void* allocate_typed(const type_helper&, size_type bytes);
+    void deallocate(void*, size_type bytes) noexcept;
+    void deallocate_aligned(void*, size_type bytes,
+                            size_type alignment) noexcept;
+    /// Keep block bigger than slot for next allocation
+    /// of the same type, if cache of type has room.
+    void deallocate_typed(const type_helper&, void*,
+                          size_type bytes) noexcept;
+
+    /// Type helper of typed page holding given slot.
+    static const type_helper& get_page_helper(const void* slot) noexcept
+    {
+        return *get_page_base(slot).helper;
+    }
+
+    /// Pool owning page of given slot.
+    static slab_pool& get_page_pool(const void* slot) noexcept
+    {
+        return *get_page_base(slot).pool;
+    }
+
+    /// Free pages left without allocated slots,
+    /// keep one of them per size class for following allocations.
+    void release_empty_pages() noexcept;
+
+    /// Number of pages currently allocated.
+    size_type get_pages_number() const noexcept;
+
+    std::pmr::memory_resource* get_upstream() const noexcept;
+
+private:
+    struct page_base
+    {
+        slab_pool* pool;
+        /// nullptr for page of size class.
+        const type_helper* helper;
+
+    }; // struct page_base
+
+    static const page_base& get_page_base(const void* slot) noexcept
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(slot);
+        return *reinterpret_cast<const page_base*>(
+                address & ~(page_size - 1u));
+    }
+
+    struct page;
+    struct free_slot;
+    struct remote_block;
+
+    struct type_cache
+    {
+        free_slot* blocks;
+        size_type blocks_number;
+        size_type block_size;
+
+    }; // struct type_cache
+
+    static constexpr size_type classes_number =
+            max_slot_size / slot_granularity;
+
+    static size_type get_class(size_type bytes) noexcept;
+
+    void* allocate_block(size_type bytes);
+    void deallocate_block(void*, size_type bytes) noexcept;
+    static page* get_page(void*) noexcept;
+
+    void* allocate_slot(size_type page_class, size_type slot_size,
+                        const type_helper*);
+    page* allocate_page(size_type page_class, size_type slot_size,
+                        const type_helper*);
+    void link(page&) noexcept;
+    void unlink(page&) noexcept;
+    void add_empty_page(size_type page_class) noexcept;
+    void remove_empty_page(size_type page_class) noexcept;
+    void deallocate_local(void*, size_type bytes) noexcept;
+    bool is_remote() const noexcept;
+    void push_remote(void*, size_type bytes) noexcept;
+    void release_remote_blocks() noexcept;
+
+private:
+    std::pmr::memory_resource* m_upstream;
+    /// Pages having free slots, size classes are followed
+    /// by typed ones indexed by type index.
+    std::vector<page*> m_available;
+    /// Released big blocks indexed by type index.
+    std::vector<type_cache> m_type_caches;
+    size_type m_pages_number;
+    /// Number of empty pages indexed as available pages.
+    std::vector<size_type> m_empty_pages;
+    /// Empty pages besides one kept per page class.
+    size_type m_releasable_pages_number;
+    /// Thread allocating from pool, none if pool is not bound.
+    std::thread::id m_owner;
+    /// Blocks freed by other threads than owner.
+    std::atomic<remote_block*> m_remote_blocks;
+
+}; // class slab_pool
+
+/// Standard allocator taking memory from slab pool of heap.
+template <typename T>
+class slab_allocator
+{
+public:
+    using value_type = T;
+
+public:
+    explicit slab_allocator(slab_pool& pool) noexcept
+    : m_pool{&pool}
+    { }
+
+    template <typename U>
+    slab_allocator(const slab_allocator<U>& other) noexcept
+    : m_pool{other.m_pool}
+    { }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_pool->allocate(n * sizeof(T)));
+    }
+
+    /// Allocate memory for chunk of given type.
+    T* allocate_typed(const type_helper& helper, std::size_t n)
+    {
+        return static_cast<T*>(m_pool->allocate_typed(helper, n * sizeof(T)));
+    }
+
+    T* allocate_aligned(std::size_t n, std::size_t alignment)
+    {
+        return static_cast<T*>(
+                m_pool->allocate_aligned(n * sizeof(T), alignment));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept
+    {
+        m_pool->deallocate(ptr, n * sizeof(T));
+    }
+
+    void deallocate_aligned(T* ptr, std::size_t n,
+                            std::size_t alignment) noexcept
+    {
+        m_pool->deallocate_aligned(ptr, n * sizeof(T), alignment);
+    }
+
+    void deallocate_typed(const type_helper& helper,
+                          T* ptr, std::size_t n) noexcept
+    {
+        m_pool->deallocate_typed(helper, ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const slab_allocator<U>& other) const noexcept
+    {
+        return m_pool == other.m_pool;
+    }
+
+    template <typename U>
+    bool operator!=(const slab_allocator<U>& other) const noexcept
+    {
+        return m_pool != other.m_pool;
+    }
+
+private:
+    template <typename U>
+    friend class slab_allocator;
+
+    slab_pool* m_pool;
+
+}; // class slab_allocator<T>
+
+template <typename Allocator>
+struct is_slab_allocator : std::false_type
+{ }; // struct is_slab_allocator<Allocator>
+
+template <typename T>
+struct is_slab_allocator<slab_allocator<T>> : std::true_type
+{ }; // struct is_slab_allocator<slab_allocator<T>>
+
+} // namespace def::detail
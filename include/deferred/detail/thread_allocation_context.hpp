@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "memory_chunk_header.hpp"
+#include "chunk_registry.hpp"
+#include "slab_allocator.hpp"
+
+namespace def::detail
+{
+
+class deferred_heap_impl;
+
+/// Allocation state of heap owned by single thread.
+/// Chunks allocated by thread are kept in context and
+/// handed over to heap when collection starts, so that
+/// allocation takes neither lock nor atomic operation.
+/// Context is used only by its thread and by heap collecting,
+/// which should not run concurrently with allocations.
+class thread_allocation_context
+{
+public:
+    using chunks_number = std::size_t;
+    using objects_number = std::size_t;
+    using bytes_number = std::size_t;
+    using chunk_unique_ptr = chunk_registry::value_type;
+
+public:
+    explicit thread_allocation_context(deferred_heap_impl&) noexcept;
+
+    thread_allocation_context(const thread_allocation_context&) = delete;
+    thread_allocation_context& operator=(
+            const thread_allocation_context&) = delete;
+
+    ~thread_allocation_context();
+
+    /// Pool of pages local to thread, bound to it.
+    slab_pool& get_slab_pool() noexcept;
+
+    /// Keep chunk until it is moved to heap,
+    /// chunk gets heap index right away.
+    void receive_chunk(chunk_unique_ptr&&);
+    /// Move all chunks received so far to heap.
+    void move_chunks_to_heap();
+    /// Release pending chunks, used by heap being destroyed.
+    void clear() noexcept;
+
+    /// Totals of chunks not moved to heap yet,
+    /// can be read from any thread.
+    chunks_number get_chunks_number() const noexcept;
+    objects_number get_objects_number() const noexcept;
+    bytes_number get_total_bytes() const noexcept;
+
+private:
+    void add_totals(std::ptrdiff_t chunks, std::ptrdiff_t objects,
+                    std::ptrdiff_t bytes) noexcept;
+
+private:
+    deferred_heap_impl& m_heap;
+    // declared first, so that it outlives chunks allocated from it
+    slab_pool m_slab_pool;
+    std::vector<chunk_unique_ptr> m_chunks;
+    // written only by thread owning context or by heap collecting
+    std::atomic<chunks_number> m_chunks_number;
+    std::atomic<objects_number> m_objects_number;
+    std::atomic<bytes_number> m_total_bytes;
+
+}; // class thread_allocation_context
+
+} // namespace def::detail
@@ -1,7 +1,7 @@
 #pragma once
 
-#include <vector>
 #include <cassert>
+#include <cstddef>
 
 #include "deferred_ptr.hpp"
 
@@ -12,6 +12,13 @@ namespace detail
 {
 
 struct memory_chunk_header;
+class mark_stack;
+class deferred_heap_impl;
+class parallel_marker;
+class type_helper;
+
+template <typename T, typename Tag>
+struct member_traverse_helper;
 
 template <bool is_class, typename T>
 struct has_visit_method_impl;
@@ -19,9 +26,6 @@ struct has_visit_method_impl;
 template <bool>
 struct apply_visitor_object_impl;
 
-template <typename T, typename Allocator>
-class type_helper_impl;
-
 } // namespace detail
 
 template <typename T>
@@ -37,20 +41,25 @@ public:
             return;
         auto* header = ptr.get_header();
         assert(header != nullptr);
-        if (is_visited(header))
-            return;
-        m_not_visited.push_back(header);
+        push(header);
     }
 
 private:
-    explicit visitor(std::vector<detail::memory_chunk_header*>& not_visited)
-    : m_not_visited{not_visited}
+    explicit visitor(detail::mark_stack& stack)
+    : m_stack{stack}
     {}
 
-    static bool is_visited(detail::memory_chunk_header*);
+    void push(detail::memory_chunk_header*);
+
+    // offset of header pointer, used to build pointer offsets of type
+    template <typename Ptr>
+    static constexpr std::size_t get_header_offset() noexcept
+    {
+        return offsetof(Ptr, m_header);
+    }
 
 private:
-    std::vector<detail::memory_chunk_header*>& m_not_visited;
+    detail::mark_stack& m_stack;
 
 private:
     // def::detail::has_visit_method functionality port
@@ -112,8 +121,12 @@ private:
 
     friend struct detail::apply_visitor_object_impl<true>;
 
-    template <typename T, typename Allocator>
-    friend class detail::type_helper_impl;
+    friend class detail::deferred_heap_impl;
+    friend class detail::parallel_marker;
+    friend class detail::type_helper;
+
+    template <typename T, typename Tag>
+    friend struct detail::member_traverse_helper;
 
 }; // class visitor
 
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "heap_registry.hpp"
+
+namespace def::detail
+{
+
+struct memory_chunk_header;
+class deferred_heap_impl;
+
+/// Write barrier for incremental and generational collection.
+/// Every deferred pointer stored while owning heap is collecting
+/// incrementally is shaded, so that already traced chunk never
+/// references non-visited one. In generational mode stores
+/// of young chunks are recorded in heap's remembered set.
+/// Called from deferred_ptr and root_ptr only when
+/// DEF_ENABLE_WRITE_BARRIER is defined.
+class write_barrier
+{
+public:
+    using heap_index_type = heap_registry::heap_index_type;
+
+public:
+    /// Slot is address of stored header pointer,
+    /// nullptr if pointer is stored outside of objects (root_ptr).
+    static void on_store(memory_chunk_header* header,
+                         memory_chunk_header* const* slot) noexcept
+    {
+        if (header != nullptr &&
+            s_active_heaps.load(std::memory_order_relaxed) != 0u)
+        {
+            on_store_active(header, slot);
+        }
+    }
+
+    /// Heap requires barrier (collects incrementally
+    /// or is generational) or stops requiring it.
+    static void activate_heap(heap_index_type, deferred_heap_impl&) noexcept;
+    static void deactivate_heap(heap_index_type) noexcept;
+
+private:
+    static void on_store_active(memory_chunk_header*,
+                                memory_chunk_header* const*) noexcept;
+
+private:
+    inline static std::atomic<std::size_t> s_active_heaps{0u};
+
+}; // class write_barrier
+
+} // namespace def::detail
@@ -0,0 +1,146 @@
+#include "deferred/detail/chunk_registry.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#include "deferred/detail/deferred_type_helper.hpp"
+
+namespace
+{
+
+using def::detail::memory_chunk_header;
+
+// Call f for every run of chunks of the same type.
+template <typename F>
+void for_each_type(memory_chunk_header** chunks, std::size_t number, F&& f)
+{
+    std::sort(chunks, chunks + number,
+              [](const memory_chunk_header* l, const memory_chunk_header* r)
+              {
+                  return l->type_index < r->type_index;
+              });
+    std::size_t first = 0;
+    while (first != number)
+    {
+        auto last = first + 1u;
+        while (last != number &&
+               chunks[last]->type_index == chunks[first]->type_index)
+            ++last;
+        f(chunks[first]->get_helper(), chunks + first, last - first);
+        first = last;
+    }
+}
+
+} // namespace
+
+namespace def::detail
+{
+
+void release_chunks(memory_chunk_header** chunks, std::size_t number)
+{
+    for_each_type(chunks, number,
+            [](const type_helper& helper, memory_chunk_header** group,
+               std::size_t size)
+            {
+                if (!helper.is_trivially_destructible)
+                    helper.destroy_many(group, size);
+                helper.deallocate_many(group, size);
+            });
+}
+
+void destroy_chunks(memory_chunk_header** chunks, std::size_t number)
+{
+    for_each_type(chunks, number,
+            [](const type_helper& helper, memory_chunk_header** group,
+               std::size_t size)
+            {
+                if (!helper.is_trivially_destructible)
+                    helper.destroy_many(group, size);
+            });
+}
+
+void deallocate_chunks(memory_chunk_header** chunks, std::size_t number)
+{
+    for_each_type(chunks, number,
+            [](const type_helper& helper, memory_chunk_header** group,
+               std::size_t size) { helper.deallocate_many(group, size); });
+}
+
+chunk_registry::chunk_registry()
+: m_segments{}
+, m_size{0u}
+{ }
+
+chunk_registry::~chunk_registry()
+{
+    clear();
+}
+
+chunk_registry::size_type chunk_registry::size() const noexcept
+{
+    return m_size;
+}
+
+bool chunk_registry::empty() const noexcept
+{
+    return m_size == 0u;
+}
+
+void chunk_registry::push_back(value_type&& chunk)
+{
+    if (m_size == m_segments.size() * segment_size)
+        m_segments.push_back(std::make_unique<value_type[]>(segment_size));
+    (*this)[m_size] = std::move(chunk);
+    ++m_size;
+}
+
+void chunk_registry::truncate(size_type new_size) noexcept
+{
+    assert(new_size <= m_size);
+    std::array<memory_chunk_header*, release_batch_size> batch;
+    auto i = new_size;
+    while (i != m_size)
+    {
+        std::size_t number = 0;
+        for (; i != m_size && number != batch.size(); ++i)
+        {
+            if ((*this)[i])
+                batch[number++] = (*this)[i].release();
+        }
+        release_chunks(batch.data(), number);
+    }
+    m_size = new_size;
+    // One spare segment is kept, so that heap oscillating
+    // around segment boundary does not allocate every time.
+    const auto used = (m_size + segment_size - 1u) / segment_size;
+    if (m_segments.size() > used + 1u)
+        m_segments.resize(used + 1u);
+}
+
+void chunk_registry::clear() noexcept
+{
+    truncate(0u);
+}
+
+chunk_registry::iterator chunk_registry::begin() noexcept
+{
+    return iterator{*this, 0u};
+}
+
+chunk_registry::iterator chunk_registry::end() noexcept
+{
+    return iterator{*this, m_size};
+}
+
+chunk_registry::const_iterator chunk_registry::begin() const noexcept
+{
+    return const_iterator{*this, 0u};
+}
+
+chunk_registry::const_iterator chunk_registry::end() const noexcept
+{
+    return const_iterator{*this, m_size};
+}
+
+} // namespace def::detail
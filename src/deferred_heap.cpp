@@ -2,11 +2,19 @@
 #include "deferred/detail/deferred_heap_impl.hpp"
 
 #include <algorithm>
+#include <array>
+#include <functional>
 #include <numeric>
 #include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <utility>
 #include <cassert>
 
 #include "deferred/detail/deferred_type_helper.hpp"
+#include "deferred/detail/visitor.hpp"
+#include "deferred/detail/write_barrier.hpp"
+#include "deferred/detail/heap_registry.hpp"
 
 namespace
 {
@@ -96,6 +104,33 @@ auto count_objects(const It& _begin, const It& _end)
             });
 }
 
+// Spawning threads is not worth it for small heaps.
+constexpr std::size_t parallel_marking_min_chunks = 4096u;
+
+// Number of chunks traced between checks of time budget
+// of incremental step.
+constexpr std::size_t incremental_step_work = 256u;
+
+// Number of unswept chunks destroyed after every chunk
+// allocated by heap, and between checks of sweep step budget.
+constexpr std::size_t lazy_sweep_allocation_work = 4u;
+constexpr std::size_t lazy_sweep_step_work = 64u;
+
+// Generational heap runs major collection instead of minor one
+// when more slots of old chunks were changed since last collection.
+constexpr std::size_t max_remembered_slots = 1u << 14u;
+
+// Generational heap runs major collection when old generation
+// has doubled and grown by at least that many chunks.
+constexpr std::size_t major_collection_min_growth = 1024u;
+
+std::pmr::memory_resource* check_resource(std::pmr::memory_resource* resource)
+{
+    if (resource == nullptr)
+        throw std::invalid_argument{"memory resource can not be null"};
+    return resource;
+}
+
 } // namespace
 
 namespace def
@@ -108,39 +143,101 @@ void deferred_memory_deleter::operator()(memory_chunk_header* chunk_ptr) const
 {
     if (chunk_ptr == nullptr)
         return;
-    if (!chunk_ptr->flags.is_destroyed())
-        chunk_ptr->helper.destroy(*chunk_ptr);
-    assert(chunk_ptr->flags.is_destroyed());
-    chunk_ptr->helper.deallocate(chunk_ptr);
+    const auto& helper = chunk_ptr->get_helper();
+    if (!helper.is_trivially_destructible)
+        helper.destroy(*chunk_ptr);
+    helper.deallocate(chunk_ptr);
 }
 
-deferred_heap_impl::deferred_heap_impl() = default;
+deferred_heap_impl::deferred_heap_impl(
+        std::pmr::memory_resource* resource)
+: m_slab_pool{resource}
+, m_thread_contexts_mutex{}
+, m_thread_contexts{}
+, m_all_chunks{}
+, m_unswept_chunks{}
+, m_lazy_sweep{false}
+, m_finalizers{}
+, m_mark_stack{}
+, m_parallel_marker{1u}
+, m_epoch{0u}
+, m_mark_bitmap{}
+, m_mark_bitmap_enabled{false}
+, m_eager_reclamation{false}
+, m_collecting{false}
+, m_rescan_position{no_rescan}
+, m_heap_index{heap_registry::acquire_index(*this)}
+, m_generational{false}
+, m_major_collection_needed{true}
+, m_old_chunks_number{0u}
+, m_major_old_chunks_number{0u}
+, m_old_chunks_index{}
+, m_old_chunks_to_rescan{}
+, m_remembered_slots_mutex{}
+, m_remembered_slots{}
+, m_root_chunks_mutex{}
+, m_root_chunks{}
+, m_chunks_number{0u}
+, m_objects_number{0u}
+, m_total_bytes{0u}
+{ }
 
-deferred_heap_impl::~deferred_heap_impl() = default;
+deferred_heap_impl::~deferred_heap_impl()
+{
+    if (m_heap_index == 0u)
+        return;
+    write_barrier::deactivate_heap(m_heap_index);
+    // chunks keep heap index, release it only when they are gone
+    m_finalizers.reset();
+    m_unswept_chunks.clear();
+    m_all_chunks.clear();
+    for (auto& context: m_thread_contexts)
+        context.second->clear();
+    heap_registry::release_index(m_heap_index);
+}
 
 deferred_heap_impl::chunks_number
 deferred_heap_impl::get_chunks_number() const
 {
-    return m_all_chunks.size();
+    auto chunks = m_chunks_number.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock{m_thread_contexts_mutex};
+    for (const auto& context: m_thread_contexts)
+        chunks += context.second->get_chunks_number();
+    return chunks;
 }
 
 deferred_heap_impl::chunks_number
 deferred_heap_impl::get_root_chunks_number() const
 {
-    return std::count_if(begin(m_all_chunks), end(m_all_chunks), root_filter);
+    if (has_root_index())
+    {
+        std::lock_guard<std::mutex> lock{m_root_chunks_mutex};
+        return m_root_chunks.size();
+    }
+    return std::count_if(m_all_chunks.begin(), m_all_chunks.end(),
+                         root_filter);
 }
 
 deferred_heap_impl::objects_number
 deferred_heap_impl::get_objects_number() const
 {
-    return count_objects(begin(m_all_chunks), end(m_all_chunks));
+    auto objects = m_objects_number.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock{m_thread_contexts_mutex};
+    for (const auto& context: m_thread_contexts)
+        objects += context.second->get_objects_number();
+    return objects;
 }
 
 deferred_heap_impl::objects_number
 deferred_heap_impl::get_root_objects_number() const
 {
-    const auto begin_v = begin(m_all_chunks);
-    const auto end_v = end(m_all_chunks);
+    if (has_root_index())
+    {
+        std::lock_guard<std::mutex> lock{m_root_chunks_mutex};
+        return count_objects(begin(m_root_chunks), end(m_root_chunks));
+    }
+    const auto begin_v = m_all_chunks.begin();
+    const auto end_v = m_all_chunks.end();
     return count_objects(filtering_iterator{begin_v, end_v, root_filter},
                          filtering_iterator{end_v, end_v, root_filter});
 }
@@ -148,12 +245,132 @@ deferred_heap_impl::get_root_objects_number() const
 deferred_heap_impl::bytes_number
 deferred_heap_impl::get_total_bytes() const
 {
-    return std::accumulate(
-            begin(m_all_chunks), end(m_all_chunks), bytes_number{0},
-            [](const auto& acc, const auto& chunk_ptr)
-            {
-                return acc + chunk_ptr->get_bytes_allocated();
-            });
+    auto bytes = m_total_bytes.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock{m_thread_contexts_mutex};
+    for (const auto& context: m_thread_contexts)
+        bytes += context.second->get_total_bytes();
+    return bytes;
+}
+
+deferred_heap_impl::size_type
+deferred_heap_impl::get_mark_stack_limit() const
+{
+    return m_mark_stack.get_max_size();
+}
+
+void deferred_heap_impl::set_mark_stack_limit(size_type limit)
+{
+    m_mark_stack.set_max_size(limit);
+    m_parallel_marker.set_max_stack_size(limit);
+}
+
+deferred_heap_impl::size_type
+deferred_heap_impl::get_mark_threads_number() const
+{
+    return m_parallel_marker.get_threads_number();
+}
+
+void deferred_heap_impl::set_mark_threads_number(size_type threads_number)
+{
+    m_parallel_marker.set_threads_number(threads_number);
+}
+
+bool deferred_heap_impl::is_mark_bitmap_enabled() const
+{
+    return m_mark_bitmap_enabled;
+}
+
+void deferred_heap_impl::set_mark_bitmap_enabled(bool enabled)
+{
+    // old chunks are marked either in bitmap or in headers
+    if (m_mark_bitmap_enabled != enabled)
+    {
+        std::lock_guard<std::mutex> lock{m_remembered_slots_mutex};
+        m_major_collection_needed = true;
+    }
+    m_mark_bitmap_enabled = enabled;
+}
+
+bool deferred_heap_impl::is_eager_reclamation_enabled() const
+{
+    return m_eager_reclamation;
+}
+
+void deferred_heap_impl::set_eager_reclamation_enabled(bool enabled)
+{
+    m_eager_reclamation = enabled;
+}
+
+bool deferred_heap_impl::is_generational_enabled() const
+{
+    return m_generational;
+}
+
+void deferred_heap_impl::set_generational_enabled(bool enabled)
+{
+    if (enabled)
+        check_write_barrier_index();
+    m_generational = enabled;
+    {
+        std::lock_guard<std::mutex> lock{m_remembered_slots_mutex};
+        m_major_collection_needed = true;
+        m_remembered_slots.clear();
+    }
+    m_old_chunks_number = 0u;
+    m_old_chunks_index.clear();
+    m_old_chunks_to_rescan.clear();
+    update_write_barrier();
+}
+
+bool deferred_heap_impl::is_lazy_sweep_enabled() const
+{
+    return m_lazy_sweep;
+}
+
+void deferred_heap_impl::set_lazy_sweep_enabled(bool enabled)
+{
+    m_lazy_sweep = enabled;
+    if (!enabled)
+        finish_sweep();
+}
+
+bool deferred_heap_impl::sweep_step(std::chrono::nanoseconds budget)
+{
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + budget;
+    if (m_finalizers && m_finalizers->has_destroyed())
+        release_finalized_chunks();
+    while (!m_unswept_chunks.empty())
+    {
+        sweep_chunks(lazy_sweep_step_work);
+        if (clock::now() >= deadline)
+            break;
+    }
+    return m_unswept_chunks.empty();
+}
+
+deferred_heap_impl::chunks_number
+deferred_heap_impl::get_unswept_chunks_number() const
+{
+    return m_unswept_chunks.size();
+}
+
+deferred_heap_impl::size_type
+deferred_heap_impl::get_finalizer_threads_number() const
+{
+    return m_finalizers ? m_finalizers->get_threads_number() : 0u;
+}
+
+void deferred_heap_impl::set_finalizer_threads_number(
+        size_type threads_number)
+{
+    if (threads_number == get_finalizer_threads_number())
+        return;
+    // waits for chunks handed over to previous threads
+    m_finalizers.reset();
+    release_empty_pages();
+    if (threads_number != 0u)
+        m_finalizers = std::make_unique<finalizer_pool>(threads_number);
 }
 
 std::tuple<deferred_heap_impl::chunks_number,
@@ -161,53 +378,452 @@ std::tuple<deferred_heap_impl::chunks_number,
         deferred_heap_impl::bytes_number>
 deferred_heap_impl::mark_and_swipe()
 {
-    clear_all_visited();
+    if (m_collecting)
+        return finish_collection();
+    if (m_generational && !is_major_collection_due())
+        return mark_and_swipe_young();
+    return mark_and_swipe_all();
+}
+
+std::tuple<deferred_heap_impl::chunks_number,
+        deferred_heap_impl::objects_number,
+        deferred_heap_impl::bytes_number>
+deferred_heap_impl::mark_and_swipe_all()
+{
+    if (m_collecting)
+        return finish_collection();
+    finish_sweep();
+    move_thread_chunks();
+    prepare_marking();
     visit_mark_all();
-    return swipe_all_non_marked();
+    return swipe_all_non_marked(0u);
+}
+
+void deferred_heap_impl::begin_collection()
+{
+    if (m_collecting)
+        throw std::logic_error{"collection is already in progress"};
+    check_write_barrier_index();
+    finish_sweep();
+    move_thread_chunks();
+    prepare_marking();
+    m_mark_stack.clear_overflowed();
+    m_rescan_position = no_rescan;
+    // heap collecting incrementally always has root index
+    for_each_root([this](memory_chunk_header* chunk) { shade(*chunk); });
+    m_collecting = true;
+    update_write_barrier();
+}
+
+bool deferred_heap_impl::step(std::chrono::nanoseconds budget)
+{
+    if (!m_collecting)
+        throw std::logic_error{"no collection in progress"};
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + budget;
+    visitor v{m_mark_stack};
+    do
+    {
+        if (mark_incrementally(v, incremental_step_work))
+            return true;
+    }
+    while (clock::now() < deadline);
+    return false;
+}
+
+std::tuple<deferred_heap_impl::chunks_number,
+        deferred_heap_impl::objects_number,
+        deferred_heap_impl::bytes_number>
+deferred_heap_impl::finish_collection()
+{
+    if (!m_collecting)
+        throw std::logic_error{"no collection in progress"};
+    // chunks allocated by threads during collection become black
+    move_thread_chunks();
+    visitor v{m_mark_stack};
+    while (!mark_incrementally(v, incremental_step_work))
+        ;
+    m_collecting = false;
+    update_write_barrier();
+    return swipe_all_non_marked(0u);
+}
+
+bool deferred_heap_impl::is_collecting() const
+{
+    return m_collecting;
+}
+
+slab_pool& deferred_heap_impl::get_slab_pool() noexcept
+{
+    return m_slab_pool;
+}
+
+std::pmr::memory_resource*
+deferred_heap_impl::get_memory_resource() const noexcept
+{
+    return m_slab_pool.get_upstream();
+}
+
+thread_allocation_context& deferred_heap_impl::get_thread_context()
+{
+    std::lock_guard<std::mutex> lock{m_thread_contexts_mutex};
+    auto& context = m_thread_contexts[std::this_thread::get_id()];
+    if (!context)
+        context = std::make_unique<thread_allocation_context>(*this);
+    return *context;
+}
+
+deferred_heap_impl::heap_index_type
+deferred_heap_impl::get_heap_index() const noexcept
+{
+    return m_heap_index;
 }
 
 void deferred_heap_impl::receive_chunk(chunk_unique_ptr&& ptr)
 {
+    adopt_chunk(std::move(ptr));
+    // allocations of heap pay for garbage of previous collection
+    if (!m_unswept_chunks.empty())
+        sweep_chunks(lazy_sweep_allocation_work);
+    if (m_finalizers && m_finalizers->has_destroyed())
+        release_finalized_chunks();
+}
+
+void deferred_heap_impl::adopt_chunk(chunk_unique_ptr&& ptr)
+{
+    using slot_type = memory_chunk_header::slot_type;
+    if (m_all_chunks.size() >= memory_chunk_header::pending_slot)
+        throw std::overflow_error{"max number of memory chunks reached"};
+    const auto objects = ptr->get_objects_number();
+    const auto bytes = ptr->get_bytes_allocated();
+    // chunk is changed only once it is registered,
+    // so that chunk of thread context stays pending on failure
     m_all_chunks.push_back(std::move(ptr));
+    auto& chunk = *m_all_chunks[m_all_chunks.size() - 1u];
+    chunk.slot = static_cast<slot_type>(m_all_chunks.size() - 1u);
+    chunk.flags.set_heap_index(m_heap_index);
+    // Chunks allocated during collection are black, in bitmap mode
+    // chunks beyond bitmap size are considered visited.
+    if (m_collecting && !m_mark_bitmap_enabled)
+        chunk.flags.mark_visited(m_epoch);
+    m_chunks_number.fetch_add(1u, std::memory_order_relaxed);
+    m_objects_number.fetch_add(objects, std::memory_order_relaxed);
+    m_total_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void deferred_heap_impl::reclaim_chunk(memory_chunk_header& chunk) noexcept
+{
+    assert(chunk.flags.is_destroyed());
+    assert(chunk.flags.get_heap_index() == m_heap_index);
+    // Marking state refers to chunk and to slots,
+    // old chunks are referenced from generational data.
+    if (!m_eager_reclamation || m_collecting || chunk.flags.is_root())
+        return;
+    // chunk is still kept by thread context
+    if (chunk.slot == memory_chunk_header::pending_slot)
+        return;
+    if (m_generational && chunk.slot < m_old_chunks_number)
+        return;
+    using slot_type = memory_chunk_header::slot_type;
+    const auto slot = chunk.slot;
+    const auto last = m_all_chunks.size() - 1u;
+    assert(m_all_chunks[slot].get() == &chunk);
+    if (slot != last)
+    {
+        std::swap(m_all_chunks[slot], m_all_chunks[last]);
+        m_all_chunks[slot]->slot = static_cast<slot_type>(slot);
+    }
+    m_chunks_number.fetch_sub(1u, std::memory_order_relaxed);
+    m_objects_number.fetch_sub(chunk.get_objects_number(),
+                               std::memory_order_relaxed);
+    m_total_bytes.fetch_sub(chunk.get_bytes_allocated(),
+                            std::memory_order_relaxed);
+    m_all_chunks.truncate(last);
+}
+
+void deferred_heap_impl::add_root(memory_chunk_header& chunk)
+{
+    assert(chunk.flags.get_heap_index() == m_heap_index);
+    std::lock_guard<std::mutex> lock{m_root_chunks_mutex};
+    m_root_chunks.insert(&chunk);
+}
+
+void deferred_heap_impl::remove_root(memory_chunk_header& chunk) noexcept
+{
+    std::lock_guard<std::mutex> lock{m_root_chunks_mutex};
+    m_root_chunks.erase(&chunk);
+}
+
+void deferred_heap_impl::on_store(memory_chunk_header& chunk,
+        memory_chunk_header* const* slot) noexcept
+{
+    if (m_collecting)
+        shade(chunk);
+    // Only stores of young chunks into old ones are interesting.
+    // Copies into stack or young chunks are not recorded, old chunks
+    // index is changed only by collection, so it is read without lock.
+    if (m_generational && slot != nullptr &&
+        chunk.slot >= m_old_chunks_number &&
+        find_old_chunk(slot) != nullptr)
+    {
+        std::lock_guard<std::mutex> lock{m_remembered_slots_mutex};
+        if (m_major_collection_needed)
+            return;
+        try
+        {
+            m_remembered_slots.insert(slot);
+        }
+        catch (...)
+        {
+            m_major_collection_needed = true;
+        }
+        // too many changed slots, major collection is cheaper
+        if (m_remembered_slots.size() > max_remembered_slots)
+            m_major_collection_needed = true;
+        if (m_major_collection_needed)
+            m_remembered_slots.clear();
+    }
+}
+
+void deferred_heap_impl::update_write_barrier() noexcept
+{
+    if (m_heap_index == 0u)
+        return;
+    if (m_collecting || m_generational)
+        write_barrier::activate_heap(m_heap_index, *this);
+    else
+        write_barrier::deactivate_heap(m_heap_index);
+}
+
+void deferred_heap_impl::check_write_barrier_index() const
+{
+    if (m_heap_index == 0u)
+        throw std::runtime_error{"too many heaps to enable write barrier"};
+}
+
+void deferred_heap_impl::shade(memory_chunk_header& chunk) noexcept
+{
+    try
+    {
+        m_mark_stack.push(&chunk);
+    }
+    catch (...)
+    {
+        // chunk is left non-visited, recovery will find it
+        m_mark_stack.mark_overflowed();
+    }
+}
+
+void deferred_heap_impl::move_thread_chunks()
+{
+    std::lock_guard<std::mutex> lock{m_thread_contexts_mutex};
+    for (auto& context: m_thread_contexts)
+        context.second->move_chunks_to_heap();
 }
 
-void deferred_heap_impl::clear_all_visited()
+bool deferred_heap_impl::has_root_index() const noexcept
 {
+    // roots of heap without index can not be reported by root_ptr
+    return m_heap_index != 0u;
+}
+
+template <typename F>
+void deferred_heap_impl::for_each_root(F&& f) const
+{
+    if (has_root_index())
+    {
+        std::lock_guard<std::mutex> lock{m_root_chunks_mutex};
+        for (auto* chunk: m_root_chunks)
+            f(chunk);
+        return;
+    }
     for (auto& chunk_ptr: m_all_chunks)
     {
-        chunk_ptr->flags.clear_visited();
+        if (chunk_ptr->flags.is_root())
+            f(chunk_ptr.get());
     }
 }
 
+void deferred_heap_impl::prepare_marking()
+{
+    mark_bitmap* bitmap = nullptr;
+    if (m_mark_bitmap_enabled)
+    {
+        m_mark_bitmap.reset(m_all_chunks.size());
+        bitmap = &m_mark_bitmap;
+    }
+    else
+    {
+        // All chunks that survived previous collection are marked
+        // with previous epoch, so any other value makes them non-visited.
+        // Epoch is not advanced in bitmap mode, so it can not wrap
+        // around to value some chunk is still marked with.
+        using chunk_flags = memory_chunk_header::chunk_flags;
+        m_epoch = m_epoch == chunk_flags::max_epoch
+                ? epoch_type{1u} : static_cast<epoch_type>(m_epoch + 1u);
+        m_mark_stack.set_epoch(m_epoch);
+        m_parallel_marker.set_epoch(m_epoch);
+    }
+    m_mark_stack.set_bitmap(bitmap);
+    m_parallel_marker.set_bitmap(bitmap);
+}
+
 void deferred_heap_impl::visit_mark_all()
 {
-    std::vector<chunk_ptr> root_chunks;
+    visitor v{m_mark_stack};
+    m_mark_stack.clear_overflowed();
+    bool completed = false;
+    if (m_parallel_marker.get_threads_number() > 1u &&
+        m_all_chunks.size() >= parallel_marking_min_chunks)
+    {
+        completed = visit_mark_all_parallel();
+    }
+    else
+    {
+        for_each_root([this](memory_chunk_header* chunk)
+                      { m_mark_stack.push(chunk); });
+        drain_mark_stack(v);
+        completed = !m_mark_stack.is_overflowed();
+    }
+    while (!completed)
+    {
+        recover_mark_stack_overflow(v);
+        completed = !m_mark_stack.is_overflowed();
+    }
+}
+
+bool deferred_heap_impl::visit_mark_all_parallel()
+{
+    for_each_root([this](memory_chunk_header* chunk)
+                  { m_parallel_marker.add_root(chunk); });
+    return m_parallel_marker.run();
+}
+
+void deferred_heap_impl::recover_mark_stack_overflow(visitor& v)
+{
+    // Chunks that did not fit into mark stack were left non-visited.
+    // Every one of them is either a root or is referenced
+    // by some visited chunk, so traverse all visited chunks again.
+    m_mark_stack.clear_overflowed();
     for (auto& chunk_ptr: m_all_chunks)
     {
-        if (!chunk_ptr->flags.is_root())
-            continue;
-        chunk_ptr->flags.mark_visited();
-        root_chunks.push_back(chunk_ptr.get());
+        rescan_chunk(*chunk_ptr, v);
+        drain_mark_stack(v);
     }
-    for (auto& chunk_ptr: root_chunks)
+}
+
+void deferred_heap_impl::rescan_chunk(memory_chunk_header& chunk,
+                                      visitor& v)
+{
+    if (m_mark_stack.is_visited(chunk))
+    {
+        if (!chunk.get_helper().is_leaf && !chunk.flags.is_destroyed())
+            chunk.get_helper().visit_children(chunk, v);
+    }
+    else if (chunk.flags.is_root())
+    {
+        m_mark_stack.push(&chunk);
+    }
+}
+
+deferred_heap_impl::size_type
+deferred_heap_impl::move_marked_to_front(size_type first)
+{
+    // Stable for marked chunks, so that header of marked chunk
+    // is written only when its slot changes. In bitmap mode
+    // chunk at index i has slot i, so headers of chunks
+    // that stay in place are not read at all.
+    constexpr auto bits_per_word = mark_bitmap::bits_per_word;
+    const auto size = m_all_chunks.size();
+    size_type marked = first;
+    size_type i = first;
+    while (i != size)
+    {
+        if (m_mark_bitmap_enabled && i % bits_per_word == 0u &&
+            i + bits_per_word <= m_mark_bitmap.size())
+        {
+            const auto word = m_mark_bitmap.get_word(i / bits_per_word);
+            if (word == 0u)
+            {
+                i += bits_per_word;
+                continue;
+            }
+            if (word == mark_bitmap::full_word && i == marked)
+            {
+                i += bits_per_word;
+                marked = i;
+                continue;
+            }
+        }
+        const bool is_marked = m_mark_bitmap_enabled
+                ? i >= m_mark_bitmap.size() || m_mark_bitmap.test(i)
+                : m_mark_stack.is_visited(*m_all_chunks[i]);
+        if (is_marked)
+        {
+            if (i != marked)
+            {
+                std::swap(m_all_chunks[marked], m_all_chunks[i]);
+                m_all_chunks[marked]->slot =
+                        static_cast<memory_chunk_header::slot_type>(marked);
+            }
+            ++marked;
+        }
+        ++i;
+    }
+    return marked;
+}
+
+bool deferred_heap_impl::mark_incrementally(visitor& v, size_type work)
+{
+    // Roots were shaded when collection began,
+    // chunk that becomes root later is shaded by write barrier.
+    // Recovery from overflow rescans one chunk per unit of work,
+    // chunks are only appended to registry while collecting.
+    for (; work != 0u; --work)
     {
-        chunk_ptr->helper.mark_recursive(*chunk_ptr);
+        if (!m_mark_stack.empty())
+        {
+            auto* chunk = m_mark_stack.pop();
+            if (!chunk->flags.is_destroyed())
+                chunk->get_helper().visit_children(*chunk, v);
+        }
+        else if (m_rescan_position < m_all_chunks.size())
+        {
+            rescan_chunk(*m_all_chunks[m_rescan_position++], v);
+        }
+        else if (m_mark_stack.is_overflowed())
+        {
+            m_mark_stack.clear_overflowed();
+            m_rescan_position = 0u;
+        }
+        else
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void deferred_heap_impl::drain_mark_stack(visitor& v)
+{
+    while (!m_mark_stack.empty())
+    {
+        auto* chunk = m_mark_stack.pop();
+        if (chunk->flags.is_destroyed())
+            continue;
+        chunk->get_helper().visit_children(*chunk, v);
     }
 }
 
 std::tuple<deferred_heap_impl::chunks_number,
         deferred_heap_impl::objects_number,
         deferred_heap_impl::bytes_number>
-deferred_heap_impl::swipe_all_non_marked()
+deferred_heap_impl::swipe_all_non_marked(size_type first)
 {
-    const auto remove_it = std::partition(
-            begin(m_all_chunks), end(m_all_chunks),
-            [](const auto& chunk_ptr) -> bool
-            {
-                return chunk_ptr->flags.is_visited();
-            });
-    const auto end_it = end(m_all_chunks);
-    const auto chunks_num = std::distance(remove_it, end_it);
+    const auto marked = move_marked_to_front(first);
+    const auto remove_it = std::next(m_all_chunks.begin(), marked);
+    const auto end_it = m_all_chunks.end();
+    const auto chunks_num = m_all_chunks.size() - marked;
     const auto obj_bytes_num = std::accumulate(remove_it, end_it,
                std::make_pair(objects_number{0}, bytes_number{0}),
                [](const auto& acc, const auto& chunk_ptr)
@@ -216,17 +832,235 @@ deferred_heap_impl::swipe_all_non_marked()
                    return pair{acc.first + chunk_ptr->get_objects_number(),
                                acc.second + chunk_ptr->get_bytes_allocated()};
                });
-    m_all_chunks.erase(remove_it, end_it);
-    m_all_chunks.shrink_to_fit();
+    if (m_finalizers)
+    {
+        m_finalizers->finalize(m_all_chunks, marked);
+    }
+    else if (m_lazy_sweep)
+    {
+        queue_unswept(marked);
+    }
+    else
+    {
+        m_all_chunks.truncate(marked);
+        release_empty_pages();
+    }
+    m_chunks_number.fetch_sub(chunks_num, std::memory_order_relaxed);
+    m_objects_number.fetch_sub(obj_bytes_num.first, std::memory_order_relaxed);
+    m_total_bytes.fetch_sub(obj_bytes_num.second, std::memory_order_relaxed);
+    if (m_generational)
+    {
+        if (first == 0u)
+        {
+            m_old_chunks_number = 0u;
+            m_old_chunks_index.clear();
+            m_old_chunks_to_rescan.clear();
+        }
+        promote_young_chunks();
+        if (first == 0u)
+            m_major_old_chunks_number = m_old_chunks_number;
+    }
+    {
+        // stores recorded so far are covered by this collection
+        std::lock_guard<std::mutex> lock{m_remembered_slots_mutex};
+        m_remembered_slots.clear();
+        if (m_generational && first == 0u)
+            m_major_collection_needed = false;
+    }
     return {chunks_num, obj_bytes_num.first, obj_bytes_num.second};
 }
 
+void deferred_heap_impl::queue_unswept(size_type first) noexcept
+{
+    // Unswept chunks are not counted by heap any more. Chunks that
+    // can not be queued because of allocation failure are destroyed.
+    try
+    {
+        for (auto i = first; i != m_all_chunks.size(); ++i)
+            m_unswept_chunks.push_back(std::move(m_all_chunks[i]));
+    }
+    catch (...)
+    {
+    }
+    m_all_chunks.truncate(first);
+}
+
+void deferred_heap_impl::sweep_chunks(size_type number) noexcept
+{
+    // Chunks are taken out of registry before being destroyed,
+    // so that destructors may allocate from heap.
+    std::array<memory_chunk_header*, chunk_registry::release_batch_size> batch;
+    while (number != 0u && !m_unswept_chunks.empty())
+    {
+        const auto size = m_unswept_chunks.size();
+        const auto taken = std::min({number, batch.size(), size});
+        for (size_type i = 0; i != taken; ++i)
+            batch[i] = m_unswept_chunks[size - taken + i].release();
+        m_unswept_chunks.truncate(size - taken);
+        release_chunks(batch.data(), taken);
+        number -= taken;
+    }
+    if (m_unswept_chunks.empty())
+        release_empty_pages();
+}
+
+void deferred_heap_impl::finish_sweep() noexcept
+{
+    if (!m_unswept_chunks.empty())
+        sweep_chunks(m_unswept_chunks.size());
+    if (m_finalizers && m_finalizers->has_destroyed())
+        release_finalized_chunks();
+}
+
+void deferred_heap_impl::release_finalized_chunks() noexcept
+{
+    m_finalizers->release_destroyed();
+    release_empty_pages();
+}
+
+void deferred_heap_impl::release_empty_pages() noexcept
+{
+    // pages of thread contexts are released by their threads
+    m_slab_pool.release_empty_pages();
+}
+
+bool deferred_heap_impl::is_major_collection_due() const noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock{m_remembered_slots_mutex};
+        if (m_major_collection_needed)
+            return true;
+    }
+    return m_old_chunks_number >= 2u * m_major_old_chunks_number
+                                  + major_collection_min_growth;
+}
+
+std::tuple<deferred_heap_impl::chunks_number,
+        deferred_heap_impl::objects_number,
+        deferred_heap_impl::bytes_number>
+deferred_heap_impl::mark_and_swipe_young()
+{
+    finish_sweep();
+    move_thread_chunks();
+    // Old chunks keep their marks, heap epoch is not advanced
+    // and bitmap is reset with old chunks prefix marked.
+    if (m_mark_bitmap_enabled)
+    {
+        m_mark_bitmap.reset(m_all_chunks.size(), m_old_chunks_number);
+        m_mark_stack.set_bitmap(&m_mark_bitmap);
+    }
+    else
+    {
+        m_mark_stack.set_epoch(m_epoch);
+        m_mark_stack.set_bitmap(nullptr);
+    }
+    visit_mark_young();
+    return swipe_all_non_marked(m_old_chunks_number);
+}
+
+void deferred_heap_impl::visit_mark_young()
+{
+    // Young chunk is reachable either from young root,
+    // or from old chunk that was changed since last collection.
+    // Pushing old chunk does nothing, as it is already visited.
+    visitor v{m_mark_stack};
+    m_mark_stack.clear_overflowed();
+    for_each_root([this](memory_chunk_header* chunk)
+                  { m_mark_stack.push(chunk); });
+    drain_mark_stack(v);
+    {
+        // visiting chunks stores nothing, so stores of other threads
+        // only wait for remembered slots to be traversed
+        std::lock_guard<std::mutex> lock{m_remembered_slots_mutex};
+        for (auto* slot: m_remembered_slots)
+        {
+            // slot keeps young chunk stored last, or any other
+            const auto* owner = find_old_chunk(slot);
+            if (owner != nullptr && !owner->flags.is_destroyed() &&
+                *slot != nullptr)
+            {
+                m_mark_stack.push(*slot);
+                drain_mark_stack(v);
+            }
+        }
+    }
+    for (auto* chunk: m_old_chunks_to_rescan)
+    {
+        if (chunk->flags.is_destroyed())
+            continue;
+        chunk->get_helper().visit_children(*chunk, v);
+        drain_mark_stack(v);
+    }
+    while (m_mark_stack.is_overflowed())
+        recover_mark_stack_overflow(v);
+}
+
+memory_chunk_header*
+deferred_heap_impl::find_old_chunk(const void* address) const noexcept
+{
+    const auto* ptr = reinterpret_cast<const unsigned char*>(address);
+    auto it = std::upper_bound(
+            begin(m_old_chunks_index), end(m_old_chunks_index), ptr,
+            [](const unsigned char* p, const old_chunk_range& range)
+            {
+                return std::less<const unsigned char*>{}(p, range.begin);
+            });
+    if (it == begin(m_old_chunks_index))
+        return nullptr;
+    --it;
+    if (!std::less<const unsigned char*>{}(ptr, it->end))
+        return nullptr;
+    return it->chunk;
+}
+
+void deferred_heap_impl::promote_young_chunks()
+{
+    // Chunks of types that may keep deferred pointers outside
+    // of their memory are always rescanned by minor collection,
+    // changes of other chunks are found through remembered slots.
+    const auto index_size = m_old_chunks_index.size();
+    for (auto i = m_old_chunks_number; i != m_all_chunks.size(); ++i)
+    {
+        auto* chunk = m_all_chunks[i].get();
+        if (!chunk->get_helper().keeps_pointers_in_place)
+        {
+            m_old_chunks_to_rescan.push_back(chunk);
+            continue;
+        }
+        const auto* begin = reinterpret_cast<const unsigned char*>(
+                chunk->get_object_start());
+        const auto bytes =
+                chunk->get_helper().bytes_per_object * chunk->get_objects_number();
+        m_old_chunks_index.push_back({begin, begin + bytes, chunk});
+    }
+    const auto by_begin = [](const old_chunk_range& l,
+                             const old_chunk_range& r)
+    {
+        return std::less<const unsigned char*>{}(l.begin, r.begin);
+    };
+    const auto middle = std::next(begin(m_old_chunks_index), index_size);
+    std::sort(middle, end(m_old_chunks_index), by_begin);
+    std::inplace_merge(begin(m_old_chunks_index), middle,
+                       end(m_old_chunks_index), by_begin);
+    m_old_chunks_number = m_all_chunks.size();
+}
+
 } // namespace detail
 
 deferred_heap::deferred_heap()
-: m_pimpl{std::make_unique<detail::deferred_heap_impl>()}
+: deferred_heap{std::pmr::new_delete_resource()}
 { }
 
+deferred_heap::deferred_heap(std::pmr::memory_resource* resource)
+: m_pimpl{std::make_unique<detail::deferred_heap_impl>(
+        check_resource(resource))}
+{ }
+
+std::pmr::memory_resource* deferred_heap::get_memory_resource() const noexcept
+{
+    return m_pimpl->get_memory_resource();
+}
+
 deferred_heap::~deferred_heap() = default;
 
 deferred_heap::chunks_number
@@ -259,12 +1093,141 @@ deferred_heap::get_total_bytes() const
     return m_pimpl->get_total_bytes();
 }
 
+deferred_heap::size_type
+deferred_heap::get_mark_stack_limit() const
+{
+    return m_pimpl->get_mark_stack_limit();
+}
+
+void deferred_heap::set_mark_stack_limit(size_type limit)
+{
+    m_pimpl->set_mark_stack_limit(limit);
+}
+
+deferred_heap::size_type
+deferred_heap::get_mark_threads_number() const
+{
+    return m_pimpl->get_mark_threads_number();
+}
+
+void deferred_heap::set_mark_threads_number(size_type threads_number)
+{
+    m_pimpl->set_mark_threads_number(threads_number);
+}
+
+bool deferred_heap::is_mark_bitmap_enabled() const
+{
+    return m_pimpl->is_mark_bitmap_enabled();
+}
+
+void deferred_heap::set_mark_bitmap_enabled(bool enabled)
+{
+    m_pimpl->set_mark_bitmap_enabled(enabled);
+}
+
+bool deferred_heap::is_eager_reclamation_enabled() const
+{
+    return m_pimpl->is_eager_reclamation_enabled();
+}
+
+void deferred_heap::set_eager_reclamation_enabled(bool enabled)
+{
+    m_pimpl->set_eager_reclamation_enabled(enabled);
+}
+
+bool deferred_heap::is_lazy_sweep_enabled() const
+{
+    return m_pimpl->is_lazy_sweep_enabled();
+}
+
+void deferred_heap::set_lazy_sweep_enabled(bool enabled)
+{
+    m_pimpl->set_lazy_sweep_enabled(enabled);
+}
+
+deferred_heap::size_type
+deferred_heap::get_finalizer_threads_number() const
+{
+    return m_pimpl->get_finalizer_threads_number();
+}
+
+void deferred_heap::set_finalizer_threads_number(size_type threads_number)
+{
+    m_pimpl->set_finalizer_threads_number(threads_number);
+}
+
+bool deferred_heap::sweep_step(std::chrono::nanoseconds budget)
+{
+    return m_pimpl->sweep_step(budget);
+}
+
+deferred_heap::chunks_number
+deferred_heap::get_unswept_chunks_number() const
+{
+    return m_pimpl->get_unswept_chunks_number();
+}
+
 simple_allocator
 deferred_heap::get_simple_allocator()
 {
     return simple_allocator{*m_pimpl};
 }
 
+simple_allocator
+deferred_heap::get_thread_allocator()
+{
+    return simple_allocator{*m_pimpl, &m_pimpl->get_thread_context()};
+}
+
+#ifdef DEF_ENABLE_WRITE_BARRIER
+
+void deferred_heap::begin_collection()
+{
+    m_pimpl->begin_collection();
+}
+
+bool deferred_heap::step(std::chrono::nanoseconds budget)
+{
+    return m_pimpl->step(budget);
+}
+
+deferred_heap::stats deferred_heap::finish_collection()
+{
+    const auto tuple_res = m_pimpl->finish_collection();
+    stats result;
+    result.chunks = std::get<0>(tuple_res);
+    result.objects = std::get<1>(tuple_res);
+    result.bytes = std::get<2>(tuple_res);
+    return result;
+}
+
+bool deferred_heap::is_collecting() const
+{
+    return m_pimpl->is_collecting();
+}
+
+bool deferred_heap::is_generational_enabled() const
+{
+    return m_pimpl->is_generational_enabled();
+}
+
+void deferred_heap::set_generational_enabled(bool enabled)
+{
+    m_pimpl->set_generational_enabled(enabled);
+}
+
+deferred_heap::stats deferred_heap::release_all_unreachable()
+{
+    const auto tuple_res = m_pimpl->mark_and_swipe_all();
+    stats result;
+    result.chunks = std::get<0>(tuple_res);
+    result.objects = std::get<1>(tuple_res);
+    result.bytes = std::get<2>(tuple_res);
+    return result;
+}
+
+#endif // DEF_ENABLE_WRITE_BARRIER
+
 deferred_heap::stats
 deferred_heap::release_unreachable()
 {
@@ -1,16 +1,38 @@
 #include "deferred/detail/deferred_simple_allocator.hpp"
 
+#include <cassert>
+
 #include "deferred/detail/deferred_heap_impl.hpp"
+#include "deferred/detail/thread_allocation_context.hpp"
 
 namespace def::detail
 {
 
 void deferred_heap_impl_move_memory_to_deferred_heap(
-        deferred_heap_impl& heap, memory_chunk_header* header) noexcept(false)
+        deferred_heap_impl& heap, thread_allocation_context* context,
+        memory_chunk_header* header) noexcept(false)
 {
     auto ptr = deferred_heap_impl::chunk_unique_ptr{
                     header, deferred_memory_deleter{}};
-    heap.receive_chunk(std::move(ptr));
+    if (context != nullptr)
+        context->receive_chunk(std::move(ptr));
+    else
+        heap.receive_chunk(std::move(ptr));
+}
+
+void deferred_heap_impl_reclaim_destroyed_memory(
+        deferred_heap_impl& heap, memory_chunk_header* header) noexcept
+{
+    assert(header != nullptr);
+    heap.reclaim_chunk(*header);
+}
+
+slab_pool& deferred_heap_impl_get_slab_pool(
+        deferred_heap_impl& heap, thread_allocation_context* context) noexcept
+{
+    if (context != nullptr)
+        return context->get_slab_pool();
+    return heap.get_slab_pool();
 }
 
 } // namespace def::detail
\ No newline at end of file
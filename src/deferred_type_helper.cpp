@@ -1,10 +1,96 @@
 #include "deferred/detail/deferred_type_helper.hpp"
 
+#include <array>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <cassert>
+
 #include "deferred/detail/memory_chunk_header.hpp"
+#include "deferred/detail/visitor.hpp"
+
+namespace
+{
+
+using def::detail::type_helper;
+
+constexpr std::size_t segment_size = 256u;
+constexpr std::size_t segments_number =
+        type_helper::max_types_number / segment_size;
+
+using segment = std::array<const type_helper*, segment_size>;
+
+// Segments are allocated on demand and read without lock:
+// chunk of type can only be reached by threads
+// that are synchronized with registration of its helper.
+struct type_helpers_table
+{
+    std::mutex mutex;
+    std::size_t size = 0u;
+    std::array<std::unique_ptr<segment>, segments_number> segments;
+
+}; // struct type_helpers_table
+
+type_helpers_table& get_table()
+{
+    static type_helpers_table table;
+    return table;
+}
+
+} // namespace
 
 namespace def::detail
 {
 
+const type_helper& type_helper::get_type_helper(type_index_type index) noexcept
+{
+    const auto& table = get_table();
+    const auto* helper =
+            (*table.segments[index / segment_size])[index % segment_size];
+    assert(helper != nullptr);
+    return *helper;
+}
+
+type_helper::type_index_type
+type_helper::register_type_helper(const type_helper& helper)
+{
+    auto& table = get_table();
+    std::lock_guard<std::mutex> lock{table.mutex};
+    if (table.size == max_types_number)
+        throw std::length_error{"max number of deferred types reached"};
+    const auto index = table.size;
+    auto& s = table.segments[index / segment_size];
+    if (!s)
+        s = std::make_unique<segment>();
+    (*s)[index % segment_size] = &helper;
+    ++table.size;
+    return static_cast<type_index_type>(index);
+}
+
+void type_helper::visit_children(memory_chunk_header& header,
+                                 visitor& v) const
+{
+    if (m_pointer_offsets == nullptr)
+    {
+        visit_children_impl(header, v);
+        return;
+    }
+    const auto* object = static_cast<const unsigned char*>(
+            header.get_object_start());
+    const auto num_objects = header.get_objects_number();
+    for (memory_chunk_header::size_t i = 0; i != num_objects;
+            ++i, object += bytes_per_object)
+    {
+        for (std::size_t j = 0; j != m_pointers_number; ++j)
+        {
+            auto* chunk = *reinterpret_cast<memory_chunk_header* const*>(
+                    object + m_pointer_offsets[j]);
+            if (chunk != nullptr)
+                v.push(chunk);
+        }
+    }
+}
+
 void type_helper::destroy(memory_chunk_header& header) const
 {
     if (header.flags.is_destroyed())
@@ -0,0 +1,143 @@
+#include "deferred/detail/finalizer_pool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <cassert>
+
+#include "deferred/detail/chunk_registry.hpp"
+
+namespace def::detail
+{
+
+finalizer_pool::finalizer_pool(size_type threads_number)
+: m_threads{}
+, m_mutex{}
+, m_batch_available{}
+, m_batches{}
+, m_destroyed{}
+, m_batches_in_flight{0u}
+, m_has_destroyed{false}
+, m_stop{false}
+{
+    if (threads_number == 0u)
+        throw std::invalid_argument{"number of finalizer threads can not be 0"};
+    try
+    {
+        m_threads.reserve(threads_number);
+        for (size_type i = 0; i != threads_number; ++i)
+            m_threads.emplace_back([this] { work(); });
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_stop = true;
+        }
+        m_batch_available.notify_all();
+        for (auto& thread: m_threads)
+            thread.join();
+        throw;
+    }
+}
+
+finalizer_pool::~finalizer_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_stop = true;
+    }
+    m_batch_available.notify_all();
+    // threads leave only when no batches are left
+    for (auto& thread: m_threads)
+        thread.join();
+    assert(m_batches.empty());
+    release_destroyed();
+}
+
+finalizer_pool::size_type
+finalizer_pool::get_threads_number() const noexcept
+{
+    return m_threads.size();
+}
+
+void finalizer_pool::finalize(chunk_registry& chunks, size_type first) noexcept
+{
+    auto i = first;
+    try
+    {
+        while (i != chunks.size())
+        {
+            const auto last = std::min(i + batch_size, chunks.size());
+            batch b;
+            b.reserve(last - i);
+            for (auto j = i; j != last; ++j)
+                b.push_back(chunks[j].get());
+            {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                m_destroyed.reserve(
+                        m_destroyed.size() + m_batches_in_flight + 1u);
+                m_batches.push_back(std::move(b));
+                ++m_batches_in_flight;
+            }
+            m_batch_available.notify_one();
+            for (; i != last; ++i)
+                chunks[i].release();
+        }
+    }
+    catch (...)
+    {
+    }
+    chunks.truncate(first);
+}
+
+bool finalizer_pool::has_destroyed() const noexcept
+{
+    return m_has_destroyed.load(std::memory_order_relaxed);
+}
+
+void finalizer_pool::release_destroyed() noexcept
+{
+    // storage of destroyed batches is kept for batches in flight
+    for (;;)
+    {
+        batch b;
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (m_destroyed.empty())
+            {
+                m_has_destroyed.store(false, std::memory_order_relaxed);
+                return;
+            }
+            b = std::move(m_destroyed.back());
+            m_destroyed.pop_back();
+        }
+        deallocate_chunks(b.data(), b.size());
+    }
+}
+
+void finalizer_pool::work() noexcept
+{
+    for (;;)
+    {
+        batch b;
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_batch_available.wait(lock, [this]
+                    { return m_stop || !m_batches.empty(); });
+            if (m_batches.empty())
+                return;
+            b = std::move(m_batches.front());
+            m_batches.pop_front();
+        }
+        // batch stays grouped by type for deallocation
+        destroy_chunks(b.data(), b.size());
+        std::lock_guard<std::mutex> lock{m_mutex};
+        assert(m_destroyed.size() < m_destroyed.capacity());
+        m_destroyed.push_back(std::move(b));
+        --m_batches_in_flight;
+        m_has_destroyed.store(true, std::memory_order_relaxed);
+    }
+}
+
+} // namespace def::detail
@@ -0,0 +1,67 @@
+#include "deferred/detail/heap_registry.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <cassert>
+
+#include "deferred/detail/memory_chunk_header.hpp"
+
+namespace
+{
+
+using heap_ptr = def::detail::deferred_heap_impl*;
+
+constexpr std::size_t heaps_number =
+        def::detail::memory_chunk_header::chunk_flags::max_heap_index + 1u;
+
+// Heap is read without lock: chunk of heap can only be
+// reached by threads that are synchronized with its creation.
+std::array<std::atomic<heap_ptr>, heaps_number>& get_heaps()
+{
+    static std::array<std::atomic<heap_ptr>, heaps_number> heaps{};
+    return heaps;
+}
+
+std::mutex& get_indices_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+} // namespace
+
+namespace def::detail
+{
+
+heap_registry::heap_index_type
+heap_registry::acquire_index(deferred_heap_impl& heap) noexcept
+{
+    std::lock_guard<std::mutex> lock{get_indices_mutex()};
+    auto& heaps = get_heaps();
+    for (std::size_t i = 1u; i != heaps_number; ++i)
+    {
+        if (heaps[i].load(std::memory_order_relaxed) == nullptr)
+        {
+            heaps[i].store(&heap, std::memory_order_release);
+            return static_cast<heap_index_type>(i);
+        }
+    }
+    return 0u;
+}
+
+void heap_registry::release_index(heap_index_type index) noexcept
+{
+    if (index == 0u)
+        return;
+    std::lock_guard<std::mutex> lock{get_indices_mutex()};
+    get_heaps()[index].store(nullptr, std::memory_order_release);
+}
+
+deferred_heap_impl* heap_registry::get_heap(heap_index_type index) noexcept
+{
+    assert(index < heaps_number);
+    return get_heaps()[index].load(std::memory_order_acquire);
+}
+
+} // namespace def::detail
@@ -0,0 +1,93 @@
+#include "deferred/detail/mark_bitmap.hpp"
+
+#include <cassert>
+
+namespace
+{
+
+using size_type = def::detail::mark_bitmap::size_type;
+using word_type = def::detail::mark_bitmap::word_type;
+
+constexpr size_type bits_per_word = def::detail::mark_bitmap::bits_per_word;
+
+size_type get_words_number(size_type bits)
+{
+    return (bits + bits_per_word - 1u) / bits_per_word;
+}
+
+word_type get_mask(size_type bit)
+{
+    return word_type{1u} << (bit % bits_per_word);
+}
+
+} // namespace
+
+namespace def::detail
+{
+
+mark_bitmap::mark_bitmap()
+: m_words{}
+, m_capacity{0u}
+, m_size{0u}
+{ }
+
+void mark_bitmap::reset(size_type bits, size_type marked)
+{
+    assert(marked <= bits);
+    const auto words_number = get_words_number(bits);
+    if (words_number > m_capacity)
+    {
+        m_words = std::make_unique<std::atomic<word_type>[]>(words_number);
+        m_capacity = words_number;
+    }
+    const auto full_words = marked / bits_per_word;
+    for (size_type i = 0; i != words_number; ++i)
+    {
+        word_type word = 0u;
+        if (i < full_words)
+            word = full_word;
+        else if (i == full_words)
+            word = get_mask(marked) - 1u;
+        m_words[i].store(word, std::memory_order_relaxed);
+    }
+    m_size = bits;
+}
+
+mark_bitmap::size_type mark_bitmap::size() const noexcept
+{
+    return m_size;
+}
+
+bool mark_bitmap::test(size_type bit) const noexcept
+{
+    assert(bit < m_size);
+    const auto word = m_words[bit / bits_per_word].load(
+            std::memory_order_relaxed);
+    return (word & get_mask(bit)) != 0u;
+}
+
+void mark_bitmap::set(size_type bit) noexcept
+{
+    assert(bit < m_size);
+    auto& word = m_words[bit / bits_per_word];
+    word.store(word.load(std::memory_order_relaxed) | get_mask(bit),
+               std::memory_order_relaxed);
+}
+
+bool mark_bitmap::try_set(size_type bit) noexcept
+{
+    assert(bit < m_size);
+    const auto mask = get_mask(bit);
+    const auto old = m_words[bit / bits_per_word].fetch_or(
+            mask, std::memory_order_relaxed);
+    return (old & mask) == 0u;
+}
+
+mark_bitmap::word_type
+mark_bitmap::get_word(size_type word_index) const noexcept
+{
+    assert(word_index < get_words_number(m_size));
+    return m_words[word_index].load(std::memory_order_relaxed);
+}
+
+} // namespace def::detail
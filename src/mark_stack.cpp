@@ -0,0 +1,168 @@
+#include "deferred/detail/mark_stack.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+#include "deferred/detail/memory_chunk_header.hpp"
+#include "deferred/detail/mark_bitmap.hpp"
+#include "deferred/detail/deferred_type_helper.hpp"
+
+namespace
+{
+
+constexpr std::size_t min_capacity = 64u;
+
+} // namespace
+
+namespace def::detail
+{
+
+mark_stack::mark_stack(size_type max_size)
+: m_data{}
+, m_max_size{0u}
+, m_overflowed{false}
+, m_concurrent{false}
+, m_epoch{1u}
+, m_bitmap{nullptr}
+{
+    set_max_size(max_size);
+}
+
+void mark_stack::push(memory_chunk_header* chunk)
+{
+    assert(chunk != nullptr);
+    if (is_visited(*chunk))
+        return;
+    // leaf chunk has nothing to trace, so it never takes stack space
+    if (chunk->get_helper().is_leaf)
+    {
+        mark_visited(*chunk);
+        return;
+    }
+    if (!reserve_one())
+    {
+        m_overflowed = true;
+        return;
+    }
+    if (mark_visited(*chunk))
+        m_data.push_back(chunk);
+}
+
+bool mark_stack::push_visited(memory_chunk_header* chunk)
+{
+    assert(chunk != nullptr);
+    assert(is_visited(*chunk));
+    if (!reserve_one())
+        return false;
+    m_data.push_back(chunk);
+    return true;
+}
+
+memory_chunk_header* mark_stack::pop() noexcept
+{
+    assert(!m_data.empty());
+    auto* chunk = m_data.back();
+    m_data.pop_back();
+    return chunk;
+}
+
+bool mark_stack::empty() const noexcept
+{
+    return m_data.empty();
+}
+
+mark_stack::size_type mark_stack::size() const noexcept
+{
+    return m_data.size();
+}
+
+bool mark_stack::is_overflowed() const noexcept
+{
+    return m_overflowed;
+}
+
+void mark_stack::mark_overflowed() noexcept
+{
+    m_overflowed = true;
+}
+
+void mark_stack::clear_overflowed() noexcept
+{
+    m_overflowed = false;
+}
+
+mark_stack::size_type mark_stack::get_max_size() const noexcept
+{
+    return m_max_size;
+}
+
+void mark_stack::set_max_size(size_type max_size)
+{
+    if (max_size == 0u)
+        throw std::invalid_argument{"mark stack max size can not be 0"};
+    assert(m_data.empty());
+    m_max_size = max_size;
+    if (m_data.capacity() > m_max_size)
+    {
+        m_data.clear();
+        m_data.shrink_to_fit();
+    }
+}
+
+void mark_stack::set_concurrent(bool concurrent) noexcept
+{
+    m_concurrent = concurrent;
+}
+
+mark_stack::epoch_type mark_stack::get_epoch() const noexcept
+{
+    return m_epoch;
+}
+
+void mark_stack::set_epoch(epoch_type epoch) noexcept
+{
+    assert(epoch != 0u);
+    m_epoch = epoch;
+}
+
+void mark_stack::set_bitmap(mark_bitmap* bitmap) noexcept
+{
+    m_bitmap = bitmap;
+}
+
+bool mark_stack::is_visited(const memory_chunk_header& chunk) const noexcept
+{
+    // chunks allocated after bitmap was reset are black
+    if (m_bitmap != nullptr)
+        return chunk.slot >= m_bitmap->size() || m_bitmap->test(chunk.slot);
+    return chunk.flags.is_visited(m_epoch);
+}
+
+bool mark_stack::mark_visited(memory_chunk_header& chunk) noexcept
+{
+    if (m_bitmap != nullptr)
+    {
+        if (m_concurrent)
+            return m_bitmap->try_set(chunk.slot);
+        m_bitmap->set(chunk.slot);
+        return true;
+    }
+    if (m_concurrent)
+        return chunk.flags.try_mark_visited(m_epoch);
+    chunk.flags.mark_visited(m_epoch);
+    return true;
+}
+
+bool mark_stack::reserve_one()
+{
+    if (m_data.size() != m_data.capacity())
+        return true;
+    if (m_data.size() >= m_max_size)
+        return false;
+    const auto capacity = std::max(m_data.capacity() * 2u, min_capacity);
+    m_data.reserve(std::min(capacity, m_max_size));
+    return true;
+}
+
+} // namespace def::detail
@@ -1,11 +1,14 @@
 #include "deferred/detail/memory_chunk_header.hpp"
 
-#include <limits>
-#include <stdexcept>
+#include <mutex>
+#include <unordered_map>
 #include <cassert>
 
 #include "deferred/detail/deferred_type_helper.hpp"
 
+static_assert(sizeof(def::detail::memory_chunk_header) == 8u,
+              "chunk header should fit into single word");
+
 namespace
 {
 
@@ -36,33 +39,132 @@ bool test_flag(const chunk_flags_underlying_type& data, const flag_base<F>&)
     return (data & flag_base<F>::value) == flag_base<F>::value;
 }
 
+using atomic_flags = std::atomic<chunk_flags_underlying_type>;
+
+// Root references are counted by any thread allocating from heap
+// and visited epoch is set by tracing threads, all of them in the
+// same word, so every modification is atomic read-modify-write.
+
+template <chunk_flags_underlying_type F>
+void set_flag(atomic_flags& data, const flag_base<F>&)
+{
+    data.fetch_or(flag_base<F>::value, std::memory_order_relaxed);
+}
+
+template <chunk_flags_underlying_type F>
+void remove_flag(atomic_flags& data, const flag_base<F>&)
+{
+    data.fetch_and(flag_base<F>::negated_value, std::memory_order_relaxed);
+}
+
+template <typename F>
+void update_flags(atomic_flags& data, F&& f)
+{
+    auto value = data.load(std::memory_order_relaxed);
+    while (!data.compare_exchange_weak(value, f(value),
+                                       std::memory_order_relaxed))
+        ;
+}
+
+template <chunk_flags_underlying_type F>
+bool test_flag(const atomic_flags& data, const flag_base<F>& flag)
+{
+    return test_flag(data.load(std::memory_order_relaxed), flag);
+}
+
 const flag_base<0x0001u> array_flag;
 const flag_base<0x0002u> destroyed_flag;
-const flag_base<0x0004u> visited_flag;
+const flag_base<0x0004u> typed_page_flag;
+
+// Bits 3-8 keep index of heap chunk belongs to.
+constexpr unsigned heap_index_shift = 3u;
+constexpr chunk_flags_underlying_type heap_index_mask = 0x01f8u;
+
+// Bits 9-11 keep epoch chunk was last visited in.
+constexpr unsigned epoch_shift = 9u;
+constexpr chunk_flags_underlying_type epoch_mask = 0x0e00u;
+
+// Bits 12-15 count root references, max value means
+// that counter continues in side table.
+constexpr unsigned roots_shift = 12u;
+constexpr chunk_flags_underlying_type roots_mask = 0xf000u;
+constexpr chunk_flags_underlying_type max_inline_roots = 0x000fu;
+constexpr chunk_flags_underlying_type one_root = 0x1000u;
+
+using epoch_type = def::detail::memory_chunk_header::chunk_flags::epoch_type;
 
+epoch_type get_epoch(chunk_flags_underlying_type data)
+{
+    return static_cast<epoch_type>((data & epoch_mask) >> epoch_shift);
+}
+
+chunk_flags_underlying_type set_epoch(chunk_flags_underlying_type data,
+                                      epoch_type epoch)
+{
+    return static_cast<chunk_flags_underlying_type>(
+            (data & ~epoch_mask) | (epoch << epoch_shift));
+}
+
+chunk_flags_underlying_type get_roots(chunk_flags_underlying_type data)
+{
+    return static_cast<chunk_flags_underlying_type>(
+            (data & roots_mask) >> roots_shift);
 }
 
+// Root references of chunks exceeding inline counter.
+// Roots of different heaps are changed by different threads.
+struct overflow_roots
+{
+    std::mutex mutex;
+    std::unordered_map<const void*, std::size_t> counters;
+
+}; // struct overflow_roots
+
+overflow_roots& get_overflow_roots()
+{
+    static overflow_roots roots;
+    return roots;
+}
+
+} // namespace
+
 namespace def::detail
 {
 
-memory_chunk_header::chunk_flags::chunk_flags(bool is_array) noexcept
-: m_data(is_array ? array_flag.value : 0u)
-, m_root_references{0u}
+memory_chunk_header::chunk_flags::chunk_flags(bool is_array,
+                                              bool in_typed_page) noexcept
+: m_data(static_cast<chunk_flags_underlying_type>(
+        (is_array ? array_flag.value : 0u)
+        | (in_typed_page ? typed_page_flag.value : 0u)))
 { }
 
-bool memory_chunk_header::chunk_flags::is_visited() const noexcept
+bool memory_chunk_header::chunk_flags::is_visited(
+        epoch_type epoch) const noexcept
 {
-    return test_flag(m_data, visited_flag);
+    assert(epoch != 0u);
+    return get_epoch(m_data.load(std::memory_order_relaxed)) == epoch;
 }
 
-void memory_chunk_header::chunk_flags::mark_visited() noexcept
+void memory_chunk_header::chunk_flags::mark_visited(epoch_type epoch) noexcept
 {
-    set_flag(m_data, visited_flag);
+    assert(epoch != 0u && epoch <= max_epoch);
+    update_flags(m_data, [epoch](chunk_flags_underlying_type value)
+                 { return set_epoch(value, epoch); });
 }
 
-void memory_chunk_header::chunk_flags::clear_visited() noexcept
+bool memory_chunk_header::chunk_flags::try_mark_visited(
+        epoch_type epoch) noexcept
 {
-    remove_flag(m_data, visited_flag);
+    assert(epoch != 0u);
+    auto value = m_data.load(std::memory_order_relaxed);
+    do
+    {
+        if (get_epoch(value) == epoch)
+            return false;
+    }
+    while (!m_data.compare_exchange_weak(value, set_epoch(value, epoch),
+                                         std::memory_order_relaxed));
+    return true;
 }
 
 bool memory_chunk_header::chunk_flags::is_array() const noexcept
@@ -70,6 +172,31 @@ bool memory_chunk_header::chunk_flags::is_array() const noexcept
     return test_flag(m_data, array_flag);
 }
 
+bool memory_chunk_header::chunk_flags::is_in_typed_page() const noexcept
+{
+    return test_flag(m_data, typed_page_flag);
+}
+
+memory_chunk_header::chunk_flags::heap_index_type
+memory_chunk_header::chunk_flags::get_heap_index() const noexcept
+{
+    const auto value = m_data.load(std::memory_order_relaxed);
+    return static_cast<heap_index_type>(
+            (value & heap_index_mask) >> heap_index_shift);
+}
+
+void memory_chunk_header::chunk_flags::set_heap_index(
+        heap_index_type index) noexcept
+{
+    assert(index <= max_heap_index);
+    update_flags(m_data, [index](chunk_flags_underlying_type value)
+                 {
+                     return static_cast<chunk_flags_underlying_type>(
+                             (value & ~heap_index_mask)
+                             | (index << heap_index_shift));
+                 });
+}
+
 bool memory_chunk_header::chunk_flags::is_destroyed() const noexcept
 {
     return test_flag(m_data, destroyed_flag);
@@ -82,24 +209,60 @@ void memory_chunk_header::chunk_flags::mark_destroyed() noexcept
 
 bool memory_chunk_header::chunk_flags::is_root() const noexcept
 {
-    return m_root_references != 0u;
+    return get_roots(m_data.load(std::memory_order_relaxed)) != 0u;
 }
 
 void memory_chunk_header::chunk_flags::increment_root_reference()
 {
-    if (m_root_references ==
-        std::numeric_limits<root_reference_counter_type>::max())
+    const auto value = m_data.load(std::memory_order_relaxed);
+    const auto roots = get_roots(value);
+    if (roots == max_inline_roots)
     {
-        throw std::overflow_error{"max number of root references reached"};
+        auto& overflow = get_overflow_roots();
+        std::lock_guard<std::mutex> lock{overflow.mutex};
+        ++overflow.counters.at(this);
+        return;
     }
-    ++m_root_references;
+    if (roots + 1u == max_inline_roots)
+    {
+        // entry left by chunk freed at same address is overwritten
+        auto& overflow = get_overflow_roots();
+        std::lock_guard<std::mutex> lock{overflow.mutex};
+        overflow.counters[this] = 1u;
+    }
+    // counter is below max, so adding can not carry to other bits
+    m_data.fetch_add(one_root, std::memory_order_relaxed);
 }
 
 void memory_chunk_header::chunk_flags::decrement_root_reference()
 {
-    if (m_root_references == 0u)
-        assert(false);
-    --m_root_references;
+    const auto value = m_data.load(std::memory_order_relaxed);
+    const auto roots = get_roots(value);
+    assert(roots != 0u);
+    if (roots == max_inline_roots)
+    {
+        auto& overflow = get_overflow_roots();
+        std::lock_guard<std::mutex> lock{overflow.mutex};
+        const auto it = overflow.counters.find(this);
+        assert(it != overflow.counters.end());
+        if (--it->second != 0u)
+            return;
+        overflow.counters.erase(it);
+    }
+    m_data.fetch_sub(one_root, std::memory_order_relaxed);
+}
+
+memory_chunk_header::memory_chunk_header(const type_helper& helper,
+                                         bool is_array,
+                                         bool in_typed_page) noexcept
+: flags{is_array, in_typed_page}
+, type_index{helper.type_index}
+, slot{0u}
+{ }
+
+const type_helper& memory_chunk_header::get_helper() const noexcept
+{
+    return type_helper::get_type_helper(type_index);
 }
 
 memory_chunk_header::size_t
@@ -121,27 +284,30 @@ void* memory_chunk_header::get_object_start() const noexcept
 
 void* memory_chunk_header::get_allocator_start() const noexcept
 {
+    // chunk in typed page keeps no allocator
+    if (flags.is_in_typed_page())
+        return const_cast<memory_chunk_header*>(this);
     const auto allocator_ptr =
             (reinterpret_cast<const uint8_t*>(this) -
-            helper.bytes_per_allocator);
+            get_helper().bytes_per_allocator);
     return const_cast<uint8_t*>(allocator_ptr);
 }
 
 void* memory_chunk_header::get_raw_memory_start() const noexcept
 {
-    if (!flags.is_array())
-        return get_allocator_start();
-    return reinterpret_cast<uint8_t*>(get_allocator_start())
-            - sizeof(memory_chunk_header::size_t);
+    const auto& helper = get_helper();
+    return reinterpret_cast<uint8_t*>(get_object_start())
+            - get_prefix_bytes(helper.bytes_per_allocator, helper.alignment,
+                               flags.is_array(), flags.is_in_typed_page());
 }
 
 memory_chunk_header::size_t
 memory_chunk_header::get_bytes_allocated() const noexcept
 {
-    size_t res = helper.bytes_per_object * get_objects_number();
-    if (flags.is_array())
-        res += sizeof(size_t);
-    return res + sizeof(memory_chunk_header) + helper.bytes_per_allocator;
+    const auto& helper = get_helper();
+    return helper.bytes_per_object * get_objects_number()
+           + get_prefix_bytes(helper.bytes_per_allocator, helper.alignment,
+                              flags.is_array(), flags.is_in_typed_page());
 }
 
 } // namespace def::detail
\ No newline at end of file
@@ -0,0 +1,250 @@
+#include "deferred/detail/parallel_marker.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <cassert>
+
+#include "deferred/detail/mark_stack.hpp"
+#include "deferred/detail/memory_chunk_header.hpp"
+#include "deferred/detail/deferred_type_helper.hpp"
+#include "deferred/detail/visitor.hpp"
+
+namespace
+{
+
+// Worker shares part of its stack only when it has
+// at least that many chunks and some other worker is idle.
+constexpr std::size_t min_chunks_to_share = 32u;
+
+} // namespace
+
+namespace def::detail
+{
+
+struct parallel_marker::worker
+{
+    worker()
+    : stack{}
+    , shared_mutex{}
+    , shared{}
+    , shared_size{0u}
+    , error{}
+    {
+        stack.set_concurrent(true);
+    }
+
+    mark_stack stack;
+    std::mutex shared_mutex;
+    std::vector<memory_chunk_header*> shared;
+    std::atomic<size_type> shared_size;
+    std::exception_ptr error;
+
+}; // struct parallel_marker::worker
+
+parallel_marker::parallel_marker(size_type threads_number)
+: m_workers{}
+, m_idle_workers{0u}
+, m_next_root_worker{0u}
+{
+    set_threads_number(threads_number);
+}
+
+parallel_marker::~parallel_marker() = default;
+
+parallel_marker::size_type
+parallel_marker::get_threads_number() const noexcept
+{
+    return m_workers.size();
+}
+
+void parallel_marker::set_threads_number(size_type threads_number)
+{
+    if (threads_number == 0u)
+        throw std::invalid_argument{"number of mark threads can not be 0"};
+    const auto max_stack_size = m_workers.empty()
+            ? mark_stack::default_max_size
+            : m_workers.front()->stack.get_max_size();
+    m_workers.resize(threads_number);
+    for (auto& w: m_workers)
+    {
+        if (!w)
+        {
+            w = std::make_unique<worker>();
+            w->stack.set_max_size(max_stack_size);
+        }
+    }
+    m_next_root_worker = 0u;
+}
+
+void parallel_marker::set_max_stack_size(size_type max_size)
+{
+    for (auto& w: m_workers)
+        w->stack.set_max_size(max_size);
+}
+
+void parallel_marker::set_epoch(epoch_type epoch) noexcept
+{
+    for (auto& w: m_workers)
+        w->stack.set_epoch(epoch);
+}
+
+void parallel_marker::set_bitmap(mark_bitmap* bitmap) noexcept
+{
+    for (auto& w: m_workers)
+        w->stack.set_bitmap(bitmap);
+}
+
+void parallel_marker::add_root(memory_chunk_header* chunk)
+{
+    assert(chunk != nullptr);
+    m_workers[m_next_root_worker]->stack.push(chunk);
+    m_next_root_worker = (m_next_root_worker + 1u) % m_workers.size();
+}
+
+bool parallel_marker::run()
+{
+    m_idle_workers = 0u;
+    bool completed = true;
+    std::vector<std::thread> threads;
+    threads.reserve(m_workers.size() - 1u);
+    auto it = std::next(begin(m_workers));
+    try
+    {
+        for (; it != end(m_workers); ++it)
+        {
+            auto& w = **it;
+            threads.emplace_back([this, &w] { work(w); });
+        }
+    }
+    catch (...)
+    {
+        // Workers that failed to start hand their chunks over
+        // to overflow recovery, which traces all visited chunks.
+        for (; it != end(m_workers); ++it)
+        {
+            auto& w = **it;
+            while (!w.stack.empty())
+                w.stack.pop();
+            ++m_idle_workers;
+        }
+        completed = false;
+    }
+    work(*m_workers.front());
+    for (auto& thread: threads)
+        thread.join();
+
+    std::exception_ptr error;
+    for (auto& w: m_workers)
+    {
+        if (w->stack.is_overflowed())
+            completed = false;
+        w->stack.clear_overflowed();
+        if (w->error && !error)
+            error = w->error;
+        w->error = nullptr;
+        while (!w->stack.empty())
+            w->stack.pop();
+        w->shared.clear();
+        w->shared_size = 0u;
+    }
+    m_next_root_worker = 0u;
+    if (error)
+        std::rethrow_exception(error);
+    return completed;
+}
+
+void parallel_marker::work(worker& w)
+{
+    try
+    {
+        visitor v{w.stack};
+        for (;;)
+        {
+            while (!w.stack.empty())
+            {
+                auto* chunk = w.stack.pop();
+                if (!chunk->flags.is_destroyed())
+                    chunk->get_helper().visit_children(*chunk, v);
+                share_work(w);
+            }
+            if (find_work(w))
+                continue;
+            if (!wait_for_work())
+                return;
+        }
+    }
+    catch (...)
+    {
+        w.error = std::current_exception();
+        ++m_idle_workers;
+    }
+}
+
+void parallel_marker::share_work(worker& w)
+{
+    if (w.stack.size() < min_chunks_to_share)
+        return;
+    if (w.shared_size.load(std::memory_order_relaxed) != 0u)
+        return;
+    if (m_idle_workers.load(std::memory_order_relaxed) == 0u)
+        return;
+    std::lock_guard<std::mutex> lock{w.shared_mutex};
+    const auto to_share = w.stack.size() / 2u;
+    for (size_type i = 0; i != to_share; ++i)
+        w.shared.push_back(w.stack.pop());
+    w.shared_size = w.shared.size();
+}
+
+bool parallel_marker::take_work(worker& w, worker& victim)
+{
+    if (victim.shared_size.load(std::memory_order_relaxed) == 0u)
+        return false;
+    std::lock_guard<std::mutex> lock{victim.shared_mutex};
+    const auto to_take = (victim.shared.size() + 1u) / 2u;
+    size_type taken = 0u;
+    for (; taken != to_take; ++taken)
+    {
+        if (!w.stack.push_visited(victim.shared.back()))
+            break;
+        victim.shared.pop_back();
+    }
+    victim.shared_size = victim.shared.size();
+    return taken != 0u;
+}
+
+bool parallel_marker::find_work(worker& w)
+{
+    // own shared chunks first, so that idle worker never has any
+    if (take_work(w, w))
+        return true;
+    for (auto& victim: m_workers)
+    {
+        if (victim.get() != &w && take_work(w, *victim))
+            return true;
+    }
+    return false;
+}
+
+bool parallel_marker::wait_for_work()
+{
+    ++m_idle_workers;
+    for (;;)
+    {
+        for (auto& w: m_workers)
+        {
+            if (w->shared_size != 0u)
+            {
+                --m_idle_workers;
+                return true;
+            }
+        }
+        if (m_idle_workers == m_workers.size())
+            return false;
+        std::this_thread::yield();
+    }
+}
+
+} // namespace def::detail
@@ -1,6 +1,40 @@
 #include "deferred/detail/root_ptr_base.hpp"
 
 #include "deferred/detail/memory_chunk_header.hpp"
+#include "deferred/detail/deferred_heap_impl.hpp"
+#include "deferred/detail/heap_registry.hpp"
+#include "deferred/detail/write_barrier.hpp"
+
+namespace
+{
+
+using def::detail::memory_chunk_header;
+using def::detail::heap_registry;
+
+void add_root(memory_chunk_header& chunk)
+{
+    auto* heap = heap_registry::get_heap(chunk.flags.get_heap_index());
+    if (heap == nullptr)
+        return;
+    try
+    {
+        heap->add_root(chunk);
+    }
+    catch (...)
+    {
+        chunk.flags.decrement_root_reference();
+        throw;
+    }
+}
+
+void remove_root(memory_chunk_header& chunk) noexcept
+{
+    auto* heap = heap_registry::get_heap(chunk.flags.get_heap_index());
+    if (heap != nullptr)
+        heap->remove_root(chunk);
+}
+
+} // namespace
 
 namespace def::detail
 {
@@ -8,13 +42,26 @@ namespace def::detail
 void root_ptr_base::increment_root_references(memory_chunk_header* ptr)
 {
     if (ptr)
+    {
+        const bool was_root = ptr->flags.is_root();
         ptr->flags.increment_root_reference();
+        if (!was_root)
+            add_root(*ptr);
+#ifdef DEF_ENABLE_WRITE_BARRIER
+        // chunk may become root after roots were shaded
+        write_barrier::on_store(ptr, nullptr);
+#endif // DEF_ENABLE_WRITE_BARRIER
+    }
 }
 
 void root_ptr_base::decrement_root_references(memory_chunk_header* ptr)
 {
     if (ptr)
+    {
         ptr->flags.decrement_root_reference();
+        if (!ptr->flags.is_root())
+            remove_root(*ptr);
+    }
 }
 
 } // namespace def::detail
@@ -0,0 +1,385 @@
+#include "deferred/detail/slab_allocator.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <cassert>
+
+#include "deferred/detail/deferred_type_helper.hpp"
+
+namespace def::detail
+{
+
+struct slab_pool::free_slot
+{
+    free_slot* next;
+
+}; // struct slab_pool::free_slot
+
+struct slab_pool::remote_block
+{
+    remote_block* next;
+    size_type bytes;
+
+}; // struct slab_pool::remote_block
+
+struct slab_pool::page : page_base
+{
+    page* prev;
+    page* next;
+    free_slot* free_slots;
+    /// Slots from here to page end were never allocated.
+    unsigned char* unused;
+    size_type used_slots;
+    size_type slot_size;
+    size_type page_class;
+    bool is_linked;
+
+    bool is_full() const noexcept
+    {
+        const auto* end = reinterpret_cast<const unsigned char*>(this)
+                          + page_size;
+        return free_slots == nullptr
+               && static_cast<size_type>(end - unused) < slot_size;
+    }
+
+}; // struct slab_pool::page
+
+slab_pool::slab_pool(std::pmr::memory_resource* upstream) noexcept
+: m_upstream{upstream}
+, m_available(classes_number, nullptr)
+, m_type_caches{}
+, m_pages_number{0u}
+, m_empty_pages(classes_number, 0u)
+, m_releasable_pages_number{0u}
+, m_owner{}
+, m_remote_blocks{nullptr}
+{ }
+
+slab_pool::~slab_pool()
+{
+    release_remote_blocks();
+    // heap releases all chunks before its pool,
+    // so all pages are empty and linked
+    for (auto*& first: m_available)
+    {
+        while (first != nullptr)
+        {
+            auto* p = first;
+            assert(p->used_slots == 0u);
+            first = p->next;
+            m_upstream->deallocate(p, page_size, page_size);
+        }
+    }
+    for (auto& cache: m_type_caches)
+    {
+        while (cache.blocks != nullptr)
+        {
+            auto* block = cache.blocks;
+            cache.blocks = block->next;
+            deallocate_block(block, cache.block_size);
+        }
+    }
+}
+
+void slab_pool::bind_to_thread() noexcept
+{
+    m_owner = std::this_thread::get_id();
+}
+
+void* slab_pool::allocate(size_type bytes)
+{
+    if (m_remote_blocks.load(std::memory_order_relaxed) != nullptr)
+        release_remote_blocks();
+    const auto size_class = get_class(bytes);
+    if (size_class == classes_number)
+        return allocate_block(bytes);
+    return allocate_slot(size_class, (size_class + 1u) * slot_granularity,
+                         nullptr);
+}
+
+void* slab_pool::allocate_aligned(size_type bytes, size_type alignment)
+{
+    if (alignment <= slot_granularity)
+        return allocate(bytes);
+    return m_upstream->allocate(bytes, alignment);
+}
+
+void* slab_pool::allocate_typed(const type_helper& helper, size_type bytes)
+{
+    assert(bytes != 0u);
+    if (m_remote_blocks.load(std::memory_order_relaxed) != nullptr)
+        release_remote_blocks();
+    if (bytes > max_slot_size)
+    {
+        if (helper.type_index >= m_type_caches.size())
+            m_type_caches.resize(helper.type_index + 1u, type_cache{});
+        auto& cache = m_type_caches[helper.type_index];
+        if (cache.blocks == nullptr)
+            return allocate_block(bytes);
+        auto* block = cache.blocks;
+        cache.blocks = block->next;
+        --cache.blocks_number;
+        return block;
+    }
+    const auto page_class = classes_number + helper.type_index;
+    if (page_class >= m_available.size())
+    {
+        m_empty_pages.resize(page_class + 1u, 0u);
+        m_available.resize(page_class + 1u, nullptr);
+    }
+    const auto slot_size = (bytes + slot_granularity - 1u)
+                           / slot_granularity * slot_granularity;
+    return allocate_slot(page_class, slot_size, &helper);
+}
+
+void* slab_pool::allocate_slot(size_type page_class, size_type slot_size,
+                               const type_helper* helper)
+{
+    auto* p = m_available[page_class];
+    if (p == nullptr)
+        p = allocate_page(page_class, slot_size, helper);
+    assert(p->slot_size == slot_size && p->helper == helper);
+    void* slot = nullptr;
+    if (p->free_slots != nullptr)
+    {
+        slot = p->free_slots;
+        p->free_slots = p->free_slots->next;
+    }
+    else
+    {
+        slot = p->unused;
+        p->unused += p->slot_size;
+    }
+    if (p->used_slots++ == 0u)
+        remove_empty_page(page_class);
+    if (p->is_full())
+        unlink(*p);
+    return slot;
+}
+
+void slab_pool::deallocate(void* ptr, size_type bytes) noexcept
+{
+    if (ptr == nullptr)
+        return;
+    if (is_remote())
+    {
+        push_remote(ptr, bytes);
+        return;
+    }
+    deallocate_local(ptr, bytes);
+}
+
+void slab_pool::deallocate_local(void* ptr, size_type bytes) noexcept
+{
+    const auto size_class = get_class(bytes);
+    if (size_class == classes_number)
+    {
+        deallocate_block(ptr, bytes);
+        return;
+    }
+    auto* p = get_page(ptr);
+    assert(p->slot_size >= bytes);
+    assert(p->used_slots != 0u);
+    auto* slot = static_cast<free_slot*>(ptr);
+    slot->next = p->free_slots;
+    p->free_slots = slot;
+    if (--p->used_slots == 0u)
+        add_empty_page(p->page_class);
+    if (!p->is_linked)
+        link(*p);
+}
+
+void slab_pool::deallocate_aligned(void* ptr, size_type bytes,
+                                   size_type alignment) noexcept
+{
+    if (alignment <= slot_granularity)
+    {
+        deallocate(ptr, bytes);
+        return;
+    }
+    if (ptr != nullptr)
+        m_upstream->deallocate(ptr, bytes, alignment);
+}
+
+void slab_pool::deallocate_typed(const type_helper& helper, void* ptr,
+                                 size_type bytes) noexcept
+{
+    if (ptr == nullptr || bytes <= max_slot_size || is_remote() ||
+        helper.type_index >= m_type_caches.size())
+    {
+        deallocate(ptr, bytes);
+        return;
+    }
+    auto& cache = m_type_caches[helper.type_index];
+    if ((cache.blocks_number + 1u) * bytes > max_cached_bytes)
+    {
+        deallocate(ptr, bytes);
+        return;
+    }
+    assert(cache.blocks_number == 0u || cache.block_size == bytes);
+    auto* block = static_cast<free_slot*>(ptr);
+    block->next = cache.blocks;
+    cache.blocks = block;
+    cache.block_size = bytes;
+    ++cache.blocks_number;
+}
+
+void slab_pool::release_empty_pages() noexcept
+{
+    // cheap when nothing can be released, kept pages are not counted
+    for (size_type page_class = 0;
+         m_releasable_pages_number != 0u
+         && page_class != m_available.size(); ++page_class)
+    {
+        if (m_empty_pages[page_class] < 2u)
+            continue;
+        bool kept = false;
+        for (auto* p = m_available[page_class];
+             p != nullptr && m_empty_pages[page_class] > 1u;)
+        {
+            auto* next = p->next;
+            if (p->used_slots == 0u)
+            {
+                if (kept)
+                {
+                    unlink(*p);
+                    remove_empty_page(page_class);
+                    m_upstream->deallocate(p, page_size, page_size);
+                    --m_pages_number;
+                }
+                kept = true;
+            }
+            p = next;
+        }
+    }
+}
+
+bool slab_pool::is_remote() const noexcept
+{
+    return m_owner != std::thread::id{}
+           && m_owner != std::this_thread::get_id();
+}
+
+void slab_pool::push_remote(void* ptr, size_type bytes) noexcept
+{
+    // every slot and block has room for link and size
+    auto* block = static_cast<remote_block*>(ptr);
+    block->bytes = bytes;
+    block->next = m_remote_blocks.load(std::memory_order_relaxed);
+    while (!m_remote_blocks.compare_exchange_weak(
+            block->next, block,
+            std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
+
+void slab_pool::release_remote_blocks() noexcept
+{
+    auto* block = m_remote_blocks.exchange(nullptr,
+                                           std::memory_order_acquire);
+    if (block == nullptr)
+        return;
+    while (block != nullptr)
+    {
+        auto* next = block->next;
+        deallocate_local(block, block->bytes);
+        block = next;
+    }
+    // heap never releases pages of pool bound to other thread
+    release_empty_pages();
+}
+
+slab_pool::size_type slab_pool::get_pages_number() const noexcept
+{
+    return m_pages_number;
+}
+
+std::pmr::memory_resource* slab_pool::get_upstream() const noexcept
+{
+    return m_upstream;
+}
+
+slab_pool::size_type slab_pool::get_class(size_type bytes) noexcept
+{
+    if (bytes == 0u || bytes > max_slot_size)
+        return classes_number;
+    return (bytes - 1u) / slot_granularity;
+}
+
+void* slab_pool::allocate_block(size_type bytes)
+{
+    return m_upstream->allocate(bytes, alignof(std::max_align_t));
+}
+
+void slab_pool::deallocate_block(void* ptr, size_type bytes) noexcept
+{
+    m_upstream->deallocate(ptr, bytes, alignof(std::max_align_t));
+}
+
+slab_pool::page* slab_pool::get_page(void* ptr) noexcept
+{
+    const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    return reinterpret_cast<page*>(address & ~(page_size - 1u));
+}
+
+slab_pool::page* slab_pool::allocate_page(size_type page_class,
+                                          size_type slot_size,
+                                          const type_helper* helper)
+{
+    constexpr size_type header_bytes =
+            (sizeof(page) + slot_granularity - 1u)
+            / slot_granularity * slot_granularity;
+    auto* memory = static_cast<unsigned char*>(
+            m_upstream->allocate(page_size, page_size));
+    auto* p = new (memory) page{};
+    p->pool = this;
+    p->helper = helper;
+    p->unused = memory + header_bytes;
+    p->slot_size = slot_size;
+    p->page_class = page_class;
+    ++m_pages_number;
+    add_empty_page(page_class);
+    link(*p);
+    return p;
+}
+
+void slab_pool::add_empty_page(size_type page_class) noexcept
+{
+    if (m_empty_pages[page_class]++ != 0u)
+        ++m_releasable_pages_number;
+}
+
+void slab_pool::remove_empty_page(size_type page_class) noexcept
+{
+    assert(m_empty_pages[page_class] != 0u);
+    if (--m_empty_pages[page_class] != 0u)
+        --m_releasable_pages_number;
+}
+
+void slab_pool::link(page& p) noexcept
+{
+    assert(!p.is_linked);
+    auto*& first = m_available[p.page_class];
+    p.prev = nullptr;
+    p.next = first;
+    if (first != nullptr)
+        first->prev = &p;
+    first = &p;
+    p.is_linked = true;
+}
+
+void slab_pool::unlink(page& p) noexcept
+{
+    assert(p.is_linked);
+    if (p.prev != nullptr)
+        p.prev->next = p.next;
+    else
+        m_available[p.page_class] = p.next;
+    if (p.next != nullptr)
+        p.next->prev = p.prev;
+    p.prev = nullptr;
+    p.next = nullptr;
+    p.is_linked = false;
+}
+
+} // namespace def::detail
@@ -0,0 +1,108 @@
+#include "deferred/detail/thread_allocation_context.hpp"
+
+#include <utility>
+#include <cassert>
+
+#include "deferred/detail/deferred_heap_impl.hpp"
+
+namespace
+{
+
+template <typename T>
+void add_relaxed(std::atomic<T>& value, std::ptrdiff_t delta) noexcept
+{
+    // only one thread writes at a time, so no read-modify-write is needed
+    const auto current = value.load(std::memory_order_relaxed);
+    value.store(static_cast<T>(current + delta), std::memory_order_relaxed);
+}
+
+} // namespace
+
+namespace def::detail
+{
+
+thread_allocation_context::thread_allocation_context(
+        deferred_heap_impl& heap) noexcept
+: m_heap{heap}
+, m_slab_pool{heap.get_memory_resource()}
+, m_chunks{}
+, m_chunks_number{0u}
+, m_objects_number{0u}
+, m_total_bytes{0u}
+{
+    m_slab_pool.bind_to_thread();
+}
+
+thread_allocation_context::~thread_allocation_context()
+{
+    clear();
+}
+
+slab_pool& thread_allocation_context::get_slab_pool() noexcept
+{
+    return m_slab_pool;
+}
+
+void thread_allocation_context::receive_chunk(chunk_unique_ptr&& ptr)
+{
+    // slot is assigned by heap, pending chunks are black during
+    // collection in bitmap mode and never reclaimed eagerly
+    ptr->slot = memory_chunk_header::pending_slot;
+    ptr->flags.set_heap_index(m_heap.get_heap_index());
+    const auto objects = ptr->get_objects_number();
+    const auto bytes = ptr->get_bytes_allocated();
+    m_chunks.push_back(std::move(ptr));
+    add_totals(1, static_cast<std::ptrdiff_t>(objects),
+               static_cast<std::ptrdiff_t>(bytes));
+}
+
+void thread_allocation_context::move_chunks_to_heap()
+{
+    while (!m_chunks.empty())
+    {
+        auto& chunk = m_chunks.back();
+        const auto objects = chunk->get_objects_number();
+        const auto bytes = chunk->get_bytes_allocated();
+        m_heap.adopt_chunk(std::move(chunk));
+        m_chunks.pop_back();
+        add_totals(-1, -static_cast<std::ptrdiff_t>(objects),
+                   -static_cast<std::ptrdiff_t>(bytes));
+    }
+}
+
+void thread_allocation_context::clear() noexcept
+{
+    m_chunks.clear();
+    add_totals(-static_cast<std::ptrdiff_t>(get_chunks_number()),
+               -static_cast<std::ptrdiff_t>(get_objects_number()),
+               -static_cast<std::ptrdiff_t>(get_total_bytes()));
+}
+
+thread_allocation_context::chunks_number
+thread_allocation_context::get_chunks_number() const noexcept
+{
+    return m_chunks_number.load(std::memory_order_relaxed);
+}
+
+thread_allocation_context::objects_number
+thread_allocation_context::get_objects_number() const noexcept
+{
+    return m_objects_number.load(std::memory_order_relaxed);
+}
+
+thread_allocation_context::bytes_number
+thread_allocation_context::get_total_bytes() const noexcept
+{
+    return m_total_bytes.load(std::memory_order_relaxed);
+}
+
+void thread_allocation_context::add_totals(std::ptrdiff_t chunks,
+                                           std::ptrdiff_t objects,
+                                           std::ptrdiff_t bytes) noexcept
+{
+    add_relaxed(m_chunks_number, chunks);
+    add_relaxed(m_objects_number, objects);
+    add_relaxed(m_total_bytes, bytes);
+}
+
+} // namespace def::detail
@@ -2,15 +2,15 @@
 
 #include <cassert>
 
-#include "deferred/detail/memory_chunk_header.hpp"
+#include "deferred/detail/mark_stack.hpp"
 
 namespace def
 {
 
-bool visitor::is_visited(detail::memory_chunk_header* ptr)
+void visitor::push(detail::memory_chunk_header* ptr)
 {
     assert(ptr != nullptr);
-    return ptr->flags.is_visited();
+    m_stack.push(ptr);
 }
 
 } // namespace def
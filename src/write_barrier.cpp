@@ -0,0 +1,57 @@
+#include "deferred/detail/write_barrier.hpp"
+
+#include <array>
+#include <cassert>
+
+#include "deferred/detail/deferred_heap_impl.hpp"
+
+namespace
+{
+
+using heap_ptr = def::detail::deferred_heap_impl*;
+
+constexpr std::size_t heaps_number =
+        def::detail::memory_chunk_header::chunk_flags::max_heap_index + 1u;
+
+// Active heap is read without lock: barrier runs on thread
+// using the heap, which is the one activating it.
+std::array<std::atomic<heap_ptr>, heaps_number>& get_active_heaps()
+{
+    static std::array<std::atomic<heap_ptr>, heaps_number> heaps{};
+    return heaps;
+}
+
+} // namespace
+
+namespace def::detail
+{
+
+void write_barrier::activate_heap(heap_index_type index,
+                                  deferred_heap_impl& heap) noexcept
+{
+    assert(index != 0u);
+    auto& active = get_active_heaps()[index];
+    if (active.exchange(&heap) == nullptr)
+        ++s_active_heaps;
+}
+
+void write_barrier::deactivate_heap(heap_index_type index) noexcept
+{
+    assert(index != 0u);
+    auto& active = get_active_heaps()[index];
+    if (active.exchange(nullptr) != nullptr)
+        --s_active_heaps;
+}
+
+void write_barrier::on_store_active(memory_chunk_header* header,
+        memory_chunk_header* const* slot) noexcept
+{
+    const auto index = header->flags.get_heap_index();
+    if (index == 0u)
+        return;
+    auto* heap = get_active_heaps()[index].load(std::memory_order_acquire);
+    if (heap != nullptr)
+        heap->on_store(*header, slot);
+}
+
+} // namespace def::detail
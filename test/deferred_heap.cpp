@@ -1,8 +1,17 @@
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "deferred/defines"
 #include "deferred/simple_allocator"
 #include "deferred/deferred_heap"
 #include "deferred/deferred_ptr"
@@ -71,3 +80,937 @@ TEST(deferred_heap, smoke)
     EXPECT_EQ(0, stats.chunks);
     EXPECT_EQ(0, stats.objects);
 }
+
+TEST(deferred_heap, statistics)
+{
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<simple_struct[]> array =
+            allocator.make_deferred<simple_struct[]>(5);
+    auto single = allocator.make_deferred<simple_struct>(1, "single");
+    EXPECT_EQ(2, heap.get_memory_chunks_number());
+    EXPECT_EQ(6, heap.get_objects_number());
+    const auto total_bytes = heap.get_total_bytes();
+    EXPECT_LT(6 * sizeof(simple_struct), total_bytes);
+
+    // destroyed chunk keeps its memory until it is released
+    allocator.destroy_deferred(std::move(single));
+    EXPECT_EQ(2, heap.get_memory_chunks_number());
+    EXPECT_EQ(total_bytes, heap.get_total_bytes());
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+    EXPECT_EQ(1, stats.objects);
+    EXPECT_EQ(1, heap.get_memory_chunks_number());
+    EXPECT_EQ(5, heap.get_objects_number());
+    EXPECT_EQ(total_bytes - stats.bytes, heap.get_total_bytes());
+
+    std::size_t chunks_seen = 0;
+    std::thread reader{[&heap, &chunks_seen]
+                       { chunks_seen = heap.get_memory_chunks_number(); }};
+    reader.join();
+    EXPECT_EQ(1, chunks_seen);
+}
+
+TEST(deferred_heap, eager_reclamation)
+{
+    def::deferred_heap heap;
+    EXPECT_FALSE(heap.is_eager_reclamation_enabled());
+    heap.set_eager_reclamation_enabled(true);
+    EXPECT_TRUE(heap.is_eager_reclamation_enabled());
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<simple_struct> first =
+            allocator.make_deferred<simple_struct>(1, "first");
+    auto middle = allocator.make_deferred<simple_struct>(2, "middle");
+    def::root_ptr<simple_struct> last =
+            allocator.make_deferred<simple_struct>(3, "last");
+    const auto total_bytes = heap.get_total_bytes();
+
+    allocator.destroy_deferred(std::move(middle));
+    EXPECT_EQ(2, heap.get_memory_chunks_number());
+    EXPECT_GT(total_bytes, heap.get_total_bytes());
+
+    // chunk referenced by another root_ptr waits for collection
+    def::root_ptr<simple_struct> first_copy =
+            def::deferred_ptr<simple_struct>{first};
+    allocator.destroy_deferred(first);
+    EXPECT_EQ(2, heap.get_memory_chunks_number());
+    first_copy = nullptr;
+
+    allocator.destroy_deferred(last);
+    EXPECT_EQ(1, heap.get_memory_chunks_number());
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+    EXPECT_EQ(0, heap.get_total_bytes());
+}
+
+namespace
+{
+
+struct counted_struct
+{
+    explicit counted_struct(std::atomic<std::size_t>& destroyed)
+    : destroyed{destroyed}
+    {}
+
+    ~counted_struct()
+    {
+        ++destroyed;
+    }
+
+    std::atomic<std::size_t>& destroyed;
+};
+
+struct slow_counted_struct : counted_struct
+{
+    using counted_struct::counted_struct;
+
+    ~slow_counted_struct()
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds{5});
+    }
+};
+
+} // namespace
+
+TEST(deferred_heap, lazy_sweep)
+{
+    constexpr std::size_t garbage_number = 1000;
+
+    def::deferred_heap heap;
+    EXPECT_FALSE(heap.is_lazy_sweep_enabled());
+    heap.set_lazy_sweep_enabled(true);
+    EXPECT_TRUE(heap.is_lazy_sweep_enabled());
+    auto allocator = heap.get_simple_allocator();
+
+    std::atomic<std::size_t> destroyed = 0;
+    def::root_ptr<counted_struct> root =
+            allocator.make_deferred<counted_struct>(destroyed);
+    for (std::size_t i = 0; i != garbage_number; ++i)
+        allocator.make_deferred<counted_struct>(destroyed);
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    EXPECT_EQ(1, heap.get_memory_chunks_number());
+    EXPECT_EQ(garbage_number, heap.get_unswept_chunks_number());
+    EXPECT_EQ(0, destroyed);
+
+    // allocations sweep some of queued chunks
+    for (std::size_t i = 0; i != 10; ++i)
+        allocator.make_deferred<simple_struct>(-1, "garbage");
+    EXPECT_LT(0, destroyed);
+    EXPECT_EQ(garbage_number, heap.get_unswept_chunks_number() + destroyed);
+
+    while (!heap.sweep_step(std::chrono::microseconds{10}))
+        ;
+    EXPECT_EQ(garbage_number, destroyed);
+    EXPECT_EQ(0, heap.get_unswept_chunks_number());
+
+    // next collection sweeps what is left first
+    allocator.make_deferred<counted_struct>(destroyed);
+    stats = heap.release_unreachable();
+    EXPECT_EQ(11, stats.chunks);
+    EXPECT_EQ(11, heap.get_unswept_chunks_number());
+    root = nullptr;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+    EXPECT_EQ(garbage_number + 1, destroyed);
+    EXPECT_EQ(1, heap.get_unswept_chunks_number());
+
+    heap.set_lazy_sweep_enabled(false);
+    EXPECT_EQ(garbage_number + 2, destroyed);
+    EXPECT_EQ(0, heap.get_unswept_chunks_number());
+    EXPECT_EQ(0, heap.get_total_bytes());
+}
+
+TEST(deferred_heap, finalizer_threads)
+{
+    constexpr std::size_t garbage_number = 10000;
+
+    def::deferred_heap heap;
+    EXPECT_EQ(0, heap.get_finalizer_threads_number());
+    heap.set_finalizer_threads_number(2);
+    EXPECT_EQ(2, heap.get_finalizer_threads_number());
+    auto allocator = heap.get_simple_allocator();
+
+    std::atomic<std::size_t> destroyed = 0;
+    def::root_ptr<counted_struct> root =
+            allocator.make_deferred<counted_struct>(destroyed);
+    for (std::size_t i = 0; i != garbage_number; ++i)
+        allocator.make_deferred<counted_struct>(destroyed);
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    EXPECT_EQ(1, heap.get_memory_chunks_number());
+    while (destroyed != garbage_number)
+        std::this_thread::yield();
+    EXPECT_TRUE(heap.sweep_step(std::chrono::microseconds{10}));
+
+    // changing number of threads waits for handed over chunks
+    for (std::size_t i = 0; i != garbage_number; ++i)
+        allocator.make_deferred<counted_struct>(destroyed);
+    root = nullptr;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number + 1, stats.chunks);
+    heap.set_finalizer_threads_number(0);
+    EXPECT_EQ(2 * garbage_number + 1, destroyed);
+    EXPECT_EQ(0, heap.get_total_bytes());
+}
+
+TEST(deferred_heap, finalizer_threads_thread_allocators)
+{
+    constexpr std::size_t garbage_number = 20000;
+
+    def::deferred_heap heap;
+    heap.set_finalizer_threads_number(2);
+    auto allocator = heap.get_simple_allocator();
+
+    std::atomic<std::size_t> destroyed = 0;
+    for (std::size_t i = 0; i != garbage_number; ++i)
+        allocator.make_deferred<slow_counted_struct>(destroyed);
+    heap.release_unreachable();
+
+    // chunks of thread contexts are moved to heap
+    // while finalizer threads keep destroying chunks
+    std::thread thread{[&heap, &destroyed]
+    {
+        auto thread_allocator = heap.get_thread_allocator();
+        for (std::size_t i = 0; i != garbage_number; ++i)
+            thread_allocator.make_deferred<counted_struct>(destroyed);
+    }};
+    thread.join();
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    heap.set_finalizer_threads_number(0);
+    EXPECT_EQ(2 * garbage_number, destroyed);
+    EXPECT_EQ(0, heap.get_total_bytes());
+}
+
+TEST(deferred_heap, release_mixed_types)
+{
+    constexpr std::size_t garbage_number = 1000;
+
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+    std::atomic<std::size_t> destroyed = 0;
+    for (std::size_t i = 0; i != garbage_number; ++i)
+    {
+        allocator.make_deferred<counted_struct>(destroyed);
+        allocator.make_deferred<simple_struct>(-1, "garbage");
+        allocator.make_deferred<int[]>(i % 3 + 1);
+        auto ptr = allocator.make_deferred<counted_struct>(destroyed);
+        // destroyed chunk is grouped with other ones of its type
+        if (i % 2 == 0)
+            allocator.destroy_deferred(std::move(ptr));
+    }
+    EXPECT_EQ(garbage_number / 2, destroyed);
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(4 * garbage_number, stats.chunks);
+    EXPECT_EQ(2 * garbage_number, destroyed);
+    EXPECT_EQ(0, heap.get_total_bytes());
+}
+
+TEST(deferred_heap, release_long_list)
+{
+    constexpr std::size_t list_size = 200000;
+
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<simple_link_struct> head =
+            allocator.make_deferred<simple_link_struct>();
+    auto tail = def::deferred_ptr<simple_link_struct>{head};
+    for (std::size_t i = 1; i != list_size; ++i)
+    {
+        tail->next = allocator.make_deferred<simple_link_struct>();
+        tail = tail->next;
+    }
+    EXPECT_EQ(list_size, heap.get_memory_chunks_number());
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(0, stats.chunks);
+    EXPECT_EQ(list_size, heap.get_memory_chunks_number());
+
+    head = nullptr;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(list_size, stats.chunks);
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+}
+
+void check_root_chunks(def::deferred_heap& heap)
+{
+    auto allocator = heap.get_simple_allocator();
+    def::root_ptr<simple_struct> first =
+            allocator.make_deferred<simple_struct>(1, "first");
+    def::root_ptr<simple_struct> first_copy =
+            def::deferred_ptr<simple_struct>{first};
+    def::root_ptr<simple_struct[]> array =
+            allocator.make_deferred<simple_struct[]>(3);
+    allocator.make_deferred<simple_struct>(2, "garbage");
+    EXPECT_EQ(2, heap.get_root_memory_chunks_number());
+    EXPECT_EQ(4, heap.get_root_objects_number());
+
+    first = nullptr;
+    EXPECT_EQ(2, heap.get_root_memory_chunks_number());
+    first_copy = nullptr;
+    EXPECT_EQ(1, heap.get_root_memory_chunks_number());
+    EXPECT_EQ(3, heap.get_root_objects_number());
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(2, stats.chunks);
+    EXPECT_EQ(1, heap.get_memory_chunks_number());
+
+    array = nullptr;
+    EXPECT_EQ(0, heap.get_root_memory_chunks_number());
+    stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+}
+
+TEST(deferred_heap, root_chunks)
+{
+    def::deferred_heap heap;
+    check_root_chunks(heap);
+
+    // heaps beyond index limit find roots by scanning chunks
+    std::vector<std::unique_ptr<def::deferred_heap>> heaps;
+    for (int i = 0; i != 64; ++i)
+        heaps.push_back(std::make_unique<def::deferred_heap>());
+    check_root_chunks(*heaps.back());
+}
+
+TEST(deferred_heap, many_root_references)
+{
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+
+    // counter in chunk header overflows to side table
+    const def::deferred_ptr<simple_struct> chunk =
+            allocator.make_deferred<simple_struct>(1, "first");
+    std::vector<def::root_ptr<simple_struct>> roots;
+    for (int i = 0; i != 40; ++i)
+        roots.emplace_back(chunk);
+    EXPECT_EQ(1, heap.get_root_memory_chunks_number());
+
+    while (roots.size() != 1u)
+    {
+        roots.pop_back();
+        EXPECT_EQ(1, heap.get_root_memory_chunks_number());
+        EXPECT_EQ(0, heap.release_unreachable().chunks);
+    }
+    roots.clear();
+    EXPECT_EQ(0, heap.get_root_memory_chunks_number());
+    EXPECT_EQ(1, heap.release_unreachable().chunks);
+}
+
+TEST(deferred_heap, mark_stack_overflow)
+{
+    constexpr std::size_t list_size = 1000;
+
+    def::deferred_heap heap;
+    heap.set_mark_stack_limit(2);
+    EXPECT_EQ(2, heap.get_mark_stack_limit());
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<simple_link_struct> head =
+            allocator.make_deferred<simple_link_struct>();
+    auto tail = def::deferred_ptr<simple_link_struct>{head};
+    for (std::size_t i = 1; i != list_size; ++i)
+    {
+        tail->leaf = allocator.make_deferred<simple_struct>(
+                static_cast<int>(i), "leaf");
+        tail->next = allocator.make_deferred<simple_link_struct>();
+        tail = tail->next;
+    }
+    allocator.make_deferred<simple_struct>(-1, "garbage");
+    const auto chunks_number = heap.get_memory_chunks_number();
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+    EXPECT_EQ(chunks_number - 1, heap.get_memory_chunks_number());
+
+    head = nullptr;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(chunks_number - 1, stats.chunks);
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+}
+
+TEST(deferred_heap, parallel_marking)
+{
+    constexpr std::size_t lists_number = 64;
+    constexpr std::size_t list_size = 200;
+
+    def::deferred_heap heap;
+    EXPECT_EQ(1, heap.get_mark_threads_number());
+    heap.set_mark_threads_number(4);
+    EXPECT_EQ(4, heap.get_mark_threads_number());
+    EXPECT_THROW(heap.set_mark_threads_number(0), std::invalid_argument);
+    auto allocator = heap.get_simple_allocator();
+
+    std::vector<def::root_ptr<simple_link_struct>> heads;
+    for (std::size_t i = 0; i != lists_number; ++i)
+    {
+        heads.push_back(allocator.make_deferred<simple_link_struct>());
+        auto tail = def::deferred_ptr<simple_link_struct>{heads.back()};
+        for (std::size_t j = 1; j != list_size; ++j)
+        {
+            tail->leaf = allocator.make_deferred<simple_struct>(
+                    static_cast<int>(j), "leaf");
+            tail->next = allocator.make_deferred<simple_link_struct>();
+            tail = tail->next;
+            allocator.make_deferred<simple_struct>(-1, "garbage");
+        }
+    }
+    const auto garbage_number = lists_number * (list_size - 1);
+    const auto chunks_number = heap.get_memory_chunks_number();
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    EXPECT_EQ(chunks_number - garbage_number,
+              heap.get_memory_chunks_number());
+
+    heap.set_mark_stack_limit(2);
+    heads.resize(lists_number / 2);
+    stats = heap.release_unreachable();
+    EXPECT_EQ((chunks_number - garbage_number) / 2, stats.chunks);
+
+    heads.clear();
+    stats = heap.release_unreachable();
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+}
+
+TEST(deferred_heap, thread_allocators)
+{
+    constexpr std::size_t threads_number = 4;
+    constexpr std::size_t list_size = 1000;
+
+    def::deferred_heap heap;
+    std::vector<def::root_ptr<simple_link_struct>> heads(threads_number);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i != threads_number; ++i)
+    {
+        threads.emplace_back([&heap, &head = heads[i]]
+        {
+            auto allocator = heap.get_thread_allocator();
+            head = def::deferred_ptr<simple_link_struct>{
+                    allocator.make_deferred<simple_link_struct>()};
+            auto tail = def::deferred_ptr<simple_link_struct>{head};
+            for (std::size_t j = 1; j != list_size; ++j)
+            {
+                tail->next = allocator.make_deferred<simple_link_struct>();
+                tail = tail->next;
+                allocator.make_deferred<simple_struct>(-1, "garbage");
+            }
+        });
+    }
+    for (auto& thread: threads)
+        thread.join();
+    const auto garbage_number = threads_number * (list_size - 1);
+    EXPECT_EQ(threads_number * list_size + garbage_number,
+              heap.get_memory_chunks_number());
+    EXPECT_EQ(threads_number, heap.get_root_memory_chunks_number());
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    EXPECT_EQ(threads_number * list_size, heap.get_memory_chunks_number());
+
+    // context of thread is kept, chunks are moved on next collection
+    auto allocator = heap.get_thread_allocator();
+    allocator.make_deferred<simple_struct>(-1, "garbage");
+    heads.clear();
+    stats = heap.release_unreachable();
+    EXPECT_EQ(threads_number * list_size + 1u, stats.chunks);
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+}
+
+TEST(deferred_heap, thread_allocator_during_sweep)
+{
+    constexpr std::size_t garbage_number = 10000;
+
+    def::deferred_heap heap;
+    heap.set_lazy_sweep_enabled(true);
+    std::atomic<int> phase = 0;
+    std::thread thread{[&heap, &phase]
+    {
+        auto allocator = heap.get_thread_allocator();
+        for (std::size_t i = 0; i != garbage_number; ++i)
+            allocator.make_deferred<simple_struct>(-1, "garbage");
+        phase = 1;
+        while (phase != 2)
+            std::this_thread::yield();
+        // heap returns swept chunks to pool of thread meanwhile
+        for (std::size_t i = 0; i != garbage_number; ++i)
+            allocator.make_deferred<simple_struct>(-1, "garbage");
+    }};
+    while (phase != 1)
+        std::this_thread::yield();
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    phase = 2;
+    while (!heap.sweep_step(std::chrono::microseconds{10}))
+        ;
+    thread.join();
+
+    stats = heap.release_unreachable();
+    EXPECT_EQ(garbage_number, stats.chunks);
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+}
+
+namespace
+{
+
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+    std::size_t outstanding_bytes = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        auto* ptr = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        outstanding_bytes += bytes;
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes,
+                       std::size_t alignment) override
+    {
+        outstanding_bytes -= bytes;
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(
+            const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+}; // class counting_resource
+
+} // namespace
+
+TEST(deferred_heap, memory_resource)
+{
+    EXPECT_THROW(def::deferred_heap{nullptr}, std::invalid_argument);
+
+    counting_resource resource;
+    {
+        def::deferred_heap heap{&resource};
+        EXPECT_EQ(&resource, heap.get_memory_resource());
+        auto allocator = heap.get_simple_allocator();
+        def::root_ptr<simple_link_struct> head =
+                allocator.make_deferred<simple_link_struct>();
+        for (std::size_t i = 0; i != 100; ++i)
+        {
+            head = allocator.make_deferred<simple_link_struct>(head);
+            allocator.make_deferred<simple_struct>(-1, "garbage");
+            allocator.make_deferred<int[]>(1000);
+        }
+        std::thread{[&heap]
+        {
+            heap.get_thread_allocator().make_deferred<simple_struct>();
+        }}.join();
+        EXPECT_LT(0u, resource.outstanding_bytes);
+
+        auto stats = heap.release_unreachable();
+        EXPECT_EQ(201, stats.chunks);
+        EXPECT_LT(0u, resource.outstanding_bytes);
+    }
+    EXPECT_EQ(0u, resource.outstanding_bytes);
+
+    // memory of heap is dropped at once after its destructors were run
+    std::pmr::monotonic_buffer_resource buffer;
+    def::deferred_heap heap{&buffer};
+    auto allocator = heap.get_simple_allocator();
+    def::root_ptr<simple_struct> root =
+            allocator.make_deferred<simple_struct>(42, "root");
+    allocator.make_deferred<simple_struct>(-1, "garbage");
+    EXPECT_EQ(1, heap.release_unreachable().chunks);
+    EXPECT_EQ(42, root->val);
+}
+
+TEST(deferred_heap, mark_epoch_wrap)
+{
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<simple_link_struct> head =
+            allocator.make_deferred<simple_link_struct>();
+    head->next = allocator.make_deferred<simple_link_struct>();
+    for (int i = 0; i != 600; ++i)
+    {
+        allocator.make_deferred<simple_struct>(i, "garbage");
+        const auto stats = heap.release_unreachable();
+        EXPECT_EQ(1, stats.chunks);
+        EXPECT_EQ(2, heap.get_memory_chunks_number());
+    }
+}
+
+TEST(deferred_heap, mark_bitmap)
+{
+    constexpr std::size_t lists_number = 64;
+    constexpr std::size_t list_size = 100;
+
+    def::deferred_heap heap;
+    EXPECT_FALSE(heap.is_mark_bitmap_enabled());
+    heap.set_mark_bitmap_enabled(true);
+    EXPECT_TRUE(heap.is_mark_bitmap_enabled());
+    auto allocator = heap.get_simple_allocator();
+
+    std::vector<def::root_ptr<simple_link_struct>> heads;
+    for (std::size_t i = 0; i != lists_number; ++i)
+    {
+        heads.push_back(allocator.make_deferred<simple_link_struct>());
+        auto tail = def::deferred_ptr<simple_link_struct>{heads.back()};
+        for (std::size_t j = 1; j != list_size; ++j)
+        {
+            tail->next = allocator.make_deferred<simple_link_struct>();
+            tail = tail->next;
+            if (j % 3 == 0)
+                allocator.make_deferred<simple_struct>(-1, "garbage");
+        }
+    }
+    const auto live_number = lists_number * list_size;
+    const auto chunks_number = heap.get_memory_chunks_number();
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(chunks_number - live_number, stats.chunks);
+    EXPECT_EQ(live_number, heap.get_memory_chunks_number());
+
+    heads.resize(lists_number / 2);
+    heap.set_mark_threads_number(4);
+    heap.set_mark_stack_limit(2);
+    stats = heap.release_unreachable();
+    EXPECT_EQ(live_number / 2, stats.chunks);
+
+    heap.set_mark_bitmap_enabled(false);
+    stats = heap.release_unreachable();
+    EXPECT_EQ(0, stats.chunks);
+    EXPECT_EQ(live_number / 2, heap.get_memory_chunks_number());
+
+    heap.set_mark_bitmap_enabled(true);
+    heads.resize(1);
+    stats = heap.release_unreachable();
+    EXPECT_EQ(live_number / 2 - list_size, stats.chunks);
+    EXPECT_EQ(list_size, heap.get_memory_chunks_number());
+}
+
+namespace
+{
+
+struct base_struct
+{
+    int base_val = 1;
+};
+
+struct derived_struct : base_struct
+{
+    int derived_val = 2;
+};
+
+struct second_base_struct
+{
+    int second_val = 3;
+};
+
+struct multiple_derived_struct : base_struct, second_base_struct
+{
+};
+
+} // namespace
+
+TEST(deferred_heap, pointer_conversion)
+{
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+    EXPECT_EQ(sizeof(void*), sizeof(def::deferred_ptr<derived_struct>));
+#else
+    EXPECT_EQ(2 * sizeof(void*), sizeof(def::deferred_ptr<derived_struct>));
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+    def::root_ptr<derived_struct> derived =
+            allocator.make_deferred<derived_struct>();
+    def::deferred_ptr<base_struct> base = derived;
+    EXPECT_EQ(static_cast<base_struct*>(derived.get()), base.get());
+    EXPECT_EQ(1, base->base_val);
+    base = nullptr;
+    EXPECT_FALSE(base);
+    base = derived;
+    EXPECT_TRUE(base);
+
+    def::root_ptr<int[]> array = allocator.make_deferred<int[]>(3, 7);
+    EXPECT_EQ(7, array[2]);
+    EXPECT_EQ(0, heap.release_unreachable().chunks);
+}
+
+TEST(deferred_heap, pointer_conversion_moving_address)
+{
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+    def::root_ptr<multiple_derived_struct> derived =
+            allocator.make_deferred<multiple_derived_struct>();
+    // second base is not at address of object
+    const auto convert = [&derived]
+    {
+        def::deferred_ptr<second_base_struct> base = derived;
+        return base->second_val;
+    };
+#ifdef DEF_SINGLE_WORD_DEFERRED_PTR
+    EXPECT_DEATH(convert(), "");
+#else
+    EXPECT_EQ(3, convert());
+#endif // DEF_SINGLE_WORD_DEFERRED_PTR
+}
+
+#ifdef DEF_ENABLE_WRITE_BARRIER
+
+TEST(deferred_heap, incremental_collection)
+{
+    constexpr std::size_t list_size = 1000;
+
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+    EXPECT_THROW(heap.step(std::chrono::nanoseconds{0}), std::logic_error);
+
+    auto make_list = [&allocator, list_size]()
+    {
+        def::root_ptr<simple_link_struct> head =
+                allocator.make_deferred<simple_link_struct>();
+        auto tail = def::deferred_ptr<simple_link_struct>{head};
+        for (std::size_t i = 1; i != list_size; ++i)
+        {
+            tail->next = allocator.make_deferred<simple_link_struct>();
+            tail = tail->next;
+        }
+        return head;
+    };
+    auto first = make_list();
+    auto second = make_list();
+
+    heap.begin_collection();
+    EXPECT_TRUE(heap.is_collecting());
+    EXPECT_THROW(heap.begin_collection(), std::logic_error);
+    EXPECT_FALSE(heap.step(std::chrono::nanoseconds{0}));
+
+    // Already traced part of first list takes over second list,
+    // second list head is not root anymore.
+    first->next->next = second->next;
+    second = nullptr;
+    def::root_ptr<simple_struct> fresh =
+            allocator.make_deferred<simple_struct>(1, "fresh");
+    allocator.make_deferred<simple_struct>(-1, "garbage");
+
+    while (!heap.step(std::chrono::milliseconds{1}))
+        ;
+    auto stats = heap.finish_collection();
+    EXPECT_FALSE(heap.is_collecting());
+    EXPECT_EQ("fresh", fresh->str);
+
+    stats = heap.release_unreachable();
+    EXPECT_EQ(list_size + 2, heap.get_memory_chunks_number());
+    std::size_t reachable = 0;
+    for (def::deferred_ptr<simple_link_struct> it = first; it; it = it->next)
+        ++reachable;
+    EXPECT_EQ(list_size + 1, reachable);
+}
+
+TEST(deferred_heap, incremental_mark_stack_overflow)
+{
+    constexpr std::size_t list_size = 1000;
+
+    def::deferred_heap heap;
+    heap.set_mark_stack_limit(2);
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<simple_link_struct> head =
+            allocator.make_deferred<simple_link_struct>();
+    auto tail = def::deferred_ptr<simple_link_struct>{head};
+    for (std::size_t i = 1; i != list_size; ++i)
+    {
+        tail->leaf = allocator.make_deferred<simple_struct>(
+                static_cast<int>(i), "leaf");
+        tail->next = allocator.make_deferred<simple_link_struct>();
+        tail = tail->next;
+    }
+    // Shading roots overflows mark stack right when collection begins.
+    std::vector<def::root_ptr<simple_link_struct>> roots;
+    for (std::size_t i = 0; i != list_size; ++i)
+        roots.push_back(allocator.make_deferred<simple_link_struct>());
+    allocator.make_deferred<simple_struct>(-1, "garbage");
+    const auto chunks_number = heap.get_memory_chunks_number();
+
+    // Rescan after overflow is spread over steps, not done at once.
+    heap.begin_collection();
+    std::size_t steps = 1;
+    while (!heap.step(std::chrono::nanoseconds{0}))
+        ++steps;
+    EXPECT_LE(chunks_number / 256, steps);
+    auto stats = heap.finish_collection();
+    EXPECT_EQ(1, stats.chunks);
+    EXPECT_EQ(chunks_number - 1, heap.get_memory_chunks_number());
+
+    head = nullptr;
+    roots.clear();
+    EXPECT_EQ(chunks_number - 1, heap.release_unreachable().chunks);
+}
+
+struct reflected_node
+{
+    reflected_node()
+    {}
+
+    reflected_node(def::deferred_ptr<reflected_node> next)
+    : next{next}
+    {}
+
+    def::deferred_ptr<reflected_node> next;
+
+    DEF_ENABLE_DEFERRED_REFLECTION(reflected_node);
+
+    DEF_REGISTER_DEFERRED_MEMBER(next);
+};
+
+template <typename T>
+std::size_t count_list(def::deferred_ptr<T> head)
+{
+    std::size_t result = 0;
+    for (; head; head = head->next)
+        ++result;
+    return result;
+}
+
+template <typename T>
+void check_generational_collection(bool use_bitmap)
+{
+    constexpr std::size_t list_size = 100;
+
+    def::deferred_heap heap;
+    heap.set_mark_bitmap_enabled(use_bitmap);
+    heap.set_generational_enabled(true);
+    EXPECT_TRUE(heap.is_generational_enabled());
+    auto allocator = heap.get_simple_allocator();
+
+    def::root_ptr<T> head = allocator.template make_deferred<T>();
+    for (std::size_t i = 1; i != list_size; ++i)
+        head->next = allocator.template make_deferred<T>(head->next);
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(0, stats.chunks);
+
+    // young garbage only
+    for (std::size_t i = 0; i != 10; ++i)
+        allocator.template make_deferred<T>();
+    stats = heap.release_unreachable();
+    EXPECT_EQ(10, stats.chunks);
+
+    // young chunks reachable only from old one
+    head->next->next = allocator.template make_deferred<T>(
+            allocator.template make_deferred<T>(head->next->next));
+    // young chunk stored into old one and overwritten
+    head->next = allocator.template make_deferred<T>(head->next);
+    head->next = head->next->next;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+    EXPECT_EQ(list_size + 2, count_list<T>(head));
+    EXPECT_EQ(list_size + 2, heap.get_memory_chunks_number());
+
+    // old garbage survives until full collection
+    head->next = nullptr;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(0, stats.chunks);
+    stats = heap.release_all_unreachable();
+    EXPECT_EQ(list_size + 1, stats.chunks);
+    EXPECT_EQ(1, heap.get_memory_chunks_number());
+
+    heap.set_generational_enabled(false);
+    head = nullptr;
+    stats = heap.release_unreachable();
+    EXPECT_EQ(1, stats.chunks);
+}
+
+TEST(deferred_heap, generational_collection)
+{
+    check_generational_collection<reflected_node>(false);
+    check_generational_collection<reflected_node>(true);
+    check_generational_collection<simple_link_struct>(false);
+    check_generational_collection<simple_link_struct>(true);
+}
+
+TEST(deferred_heap, generational_thread_allocators)
+{
+    constexpr std::size_t threads_number = 4;
+    constexpr std::size_t list_size = 1000;
+
+    def::deferred_heap heap;
+    heap.set_generational_enabled(true);
+    auto allocator = heap.get_simple_allocator();
+    // one old chunk per thread, young lists are stored into them
+    std::vector<def::root_ptr<simple_link_struct>> owners;
+    for (std::size_t i = 0; i != threads_number; ++i)
+        owners.push_back(allocator.make_deferred<simple_link_struct>());
+    heap.release_unreachable();
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i != threads_number; ++i)
+    {
+        threads.emplace_back([&heap, owner = owners[i].get()]
+        {
+            auto thread_allocator = heap.get_thread_allocator();
+            owner->next = thread_allocator.make_deferred<simple_link_struct>();
+            auto tail = owner->next;
+            for (std::size_t j = 1; j != list_size; ++j)
+            {
+                tail->next =
+                        thread_allocator.make_deferred<simple_link_struct>();
+                tail = tail->next;
+                thread_allocator.make_deferred<simple_struct>(-1, "garbage");
+            }
+        });
+    }
+    for (auto& thread: threads)
+        thread.join();
+
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(threads_number * (list_size - 1), stats.chunks);
+    EXPECT_EQ(threads_number * (list_size + 1),
+              heap.get_memory_chunks_number());
+    owners.clear();
+    stats = heap.release_all_unreachable();
+    EXPECT_EQ(threads_number * (list_size + 1), stats.chunks);
+}
+
+TEST(deferred_heap, generational_remembered_slots)
+{
+    // more than heap remembers between collections
+    constexpr std::size_t nodes_number = 20000;
+
+    def::deferred_heap heap;
+    heap.set_generational_enabled(true);
+    auto allocator = heap.get_simple_allocator();
+    std::vector<def::root_ptr<reflected_node>> nodes;
+    for (std::size_t i = 0; i != nodes_number; ++i)
+        nodes.push_back(allocator.make_deferred<reflected_node>());
+    def::root_ptr<reflected_node> old_garbage =
+            allocator.make_deferred<reflected_node>();
+    heap.release_unreachable();
+    old_garbage = nullptr;
+
+    // copies outside of old chunks are not remembered
+    def::root_ptr<reflected_node> young =
+            allocator.make_deferred<reflected_node>();
+    for (std::size_t i = 0; i != nodes_number; ++i)
+        auto copy = def::deferred_ptr<reflected_node>{young};
+    auto stats = heap.release_unreachable();
+    EXPECT_EQ(0, stats.chunks);
+    EXPECT_EQ(nodes_number + 2, heap.get_memory_chunks_number());
+
+    // too many changed old chunks run major collection
+    young = nullptr;
+    for (auto& node: nodes)
+        node->next = allocator.make_deferred<reflected_node>();
+    stats = heap.release_unreachable();
+    EXPECT_EQ(2, stats.chunks);
+    EXPECT_EQ(2 * nodes_number, heap.get_memory_chunks_number());
+}
+
+#endif // DEF_ENABLE_WRITE_BARRIER
@@ -3,11 +3,17 @@
 
 #include <array>
 #include <memory>
+#include <cstdint>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 #include "deferred/simple_allocator"
 #include "deferred/deferred_heap"
 
+#include "deferred/detail/slab_allocator.hpp"
+#include "deferred/detail/deferred_type_helper_impl.hpp"
+
 namespace
 {
 
@@ -688,3 +694,211 @@ TEST_F(simple_allocator, allocate_custom_arr_two)
     EXPECT_CALL(m_observer, allocator_destroyed_object()).Times(2);
     EXPECT_CALL(m_observer, destroyed(array_val)).Times(3);
 }
+
+TEST(slab_pool, reuse_and_release_pages)
+{
+    using pool_type = def::detail::slab_pool;
+    constexpr std::size_t slot_size = 48u;
+    constexpr std::size_t slots_number =
+            3u * pool_type::page_size / slot_size;
+
+    pool_type pool;
+    std::vector<void*> slots;
+    for (std::size_t i = 0; i != slots_number; ++i)
+        slots.push_back(pool.allocate(slot_size));
+    const auto pages_number = pool.get_pages_number();
+    EXPECT_LE(3u, pages_number);
+    for (auto* slot: slots)
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(slot) % 16u);
+
+    // freed slot is reused first
+    pool.deallocate(slots.back(), slot_size);
+    EXPECT_EQ(slots.back(), pool.allocate(slot_size));
+
+    for (auto* slot: slots)
+        pool.deallocate(slot, slot_size);
+    EXPECT_EQ(pages_number, pool.get_pages_number());
+    pool.release_empty_pages();
+    EXPECT_EQ(1u, pool.get_pages_number());
+
+    auto* big = pool.allocate(pool_type::max_slot_size + 1u);
+    EXPECT_EQ(1u, pool.get_pages_number());
+    pool.deallocate(big, pool_type::max_slot_size + 1u);
+}
+
+TEST(slab_pool, typed_pages)
+{
+    using pool_type = def::detail::slab_pool;
+    using int_helper = def::detail::type_helper_impl<
+            int, def::detail::slab_allocator<int>>;
+    using double_helper = def::detail::type_helper_impl<
+            double, def::detail::slab_allocator<double>>;
+    constexpr std::size_t slot_size = 32u;
+
+    pool_type pool;
+    auto& int_type = int_helper::instance();
+    auto& double_type = double_helper::instance();
+    EXPECT_NE(int_type.type_index, double_type.type_index);
+
+    auto* first = pool.allocate_typed(int_type, slot_size);
+    auto* second = pool.allocate_typed(double_type, slot_size);
+    auto* third = pool.allocate_typed(int_type, slot_size);
+    EXPECT_EQ(&int_type, &pool_type::get_page_helper(first));
+    EXPECT_EQ(&double_type, &pool_type::get_page_helper(second));
+    EXPECT_EQ(&int_type, &pool_type::get_page_helper(third));
+    EXPECT_EQ(2u, pool.get_pages_number());
+
+    pool.deallocate(first, slot_size);
+    pool.deallocate(second, slot_size);
+    pool.deallocate(third, slot_size);
+}
+
+TEST(slab_pool, release_typed_pages)
+{
+    using pool_type = def::detail::slab_pool;
+    using int_helper = def::detail::type_helper_impl<
+            int, def::detail::slab_allocator<int>>;
+    constexpr std::size_t slot_size = 64u;
+    constexpr std::size_t slots_number =
+            3u * pool_type::page_size / slot_size;
+
+    pool_type pool;
+    auto& int_type = int_helper::instance();
+    std::vector<void*> slots;
+    for (std::size_t i = 0; i != slots_number; ++i)
+        slots.push_back(pool.allocate_typed(int_type, slot_size));
+    slots.push_back(pool.allocate(slot_size));
+    const auto pages_number = pool.get_pages_number();
+    EXPECT_LE(5u, pages_number);
+
+    // one empty page is kept for every class
+    pool.release_empty_pages();
+    EXPECT_EQ(pages_number, pool.get_pages_number());
+    for (auto* slot: slots)
+        pool.deallocate(slot, slot_size);
+    pool.release_empty_pages();
+    EXPECT_EQ(2u, pool.get_pages_number());
+    pool.release_empty_pages();
+    EXPECT_EQ(2u, pool.get_pages_number());
+}
+
+TEST_F(simple_allocator, allocate_stateless)
+{
+    // chunk keeps only header besides object
+    const auto int_one_obj = m_deferred_allocator
+            .allocate_deferred<std::int64_t>(std::allocator<std::int64_t>{},
+                                             42);
+    ASSERT_TRUE(int_one_obj);
+    EXPECT_EQ(42, *int_one_obj);
+    EXPECT_EQ(sizeof(std::int64_t) + sizeof(def::detail::memory_chunk_header),
+              m_heap.get_total_bytes());
+
+    const auto arr_obj = m_deferred_allocator
+            .allocate_deferred<int[]>(std::allocator<int>{}, 3u, 7);
+    ASSERT_TRUE(arr_obj);
+    EXPECT_EQ(7, arr_obj[2]);
+}
+
+TEST(slab_pool, typed_block_cache)
+{
+    using pool_type = def::detail::slab_pool;
+    using big_type = std::array<char, 1024>;
+    using big_helper = def::detail::type_helper_impl<
+            big_type, def::detail::slab_allocator<big_type>>;
+    constexpr std::size_t block_size = sizeof(big_type) + 16u;
+    constexpr std::size_t cached_number =
+            pool_type::max_cached_bytes / block_size;
+
+    pool_type pool;
+    auto& helper = big_helper::instance();
+    std::vector<void*> blocks;
+    for (std::size_t i = 0; i != 2u * cached_number; ++i)
+        blocks.push_back(pool.allocate_typed(helper, block_size));
+    EXPECT_EQ(0u, pool.get_pages_number());
+
+    // released blocks are reused in reverse order up to cache limit
+    for (auto* block: blocks)
+        pool.deallocate_typed(helper, block, block_size);
+    std::vector<void*> reused;
+    for (std::size_t i = 0; i != cached_number; ++i)
+    {
+        reused.push_back(pool.allocate_typed(helper, block_size));
+        EXPECT_EQ(blocks[cached_number - 1u - i], reused.back());
+    }
+    for (auto* block: reused)
+        pool.deallocate_typed(helper, block, block_size);
+}
+
+TEST(type_helper, trivially_destructible)
+{
+    using def::detail::type_helper_impl;
+    using def::detail::slab_allocator;
+
+    EXPECT_TRUE((type_helper_impl<int, slab_allocator<int>>::instance()
+            .is_trivially_destructible));
+    EXPECT_TRUE((type_helper_impl<int, std::allocator<int>>::instance()
+            .is_trivially_destructible));
+    EXPECT_FALSE((type_helper_impl<std::string,
+            slab_allocator<std::string>>::instance()
+            .is_trivially_destructible));
+    // allocator may do more than call destructor
+    EXPECT_FALSE((type_helper_impl<int, simple_std_allocator<int>>::instance()
+            .is_trivially_destructible));
+}
+
+TEST(slab_pool, over_aligned_chunks)
+{
+    struct alignas(64) aligned_struct
+    {
+        std::int64_t value;
+    };
+
+    def::deferred_heap heap;
+    auto allocator = heap.get_simple_allocator();
+    {
+        std::vector<def::deferred_ptr<aligned_struct>> singles;
+        for (std::int64_t i = 0; i != 8; ++i)
+            singles.push_back(allocator.make_deferred<aligned_struct>(
+                    aligned_struct{i}));
+        for (std::size_t i = 0; i != singles.size(); ++i)
+        {
+            EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(
+                    singles[i].get()) % alignof(aligned_struct));
+            EXPECT_EQ(static_cast<std::int64_t>(i), singles[i]->value);
+        }
+
+        const auto array = allocator.make_deferred<aligned_struct[]>(3u);
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(
+                &array[0]) % alignof(aligned_struct));
+    }
+    heap.release_unreachable();
+    EXPECT_EQ(0, heap.get_memory_chunks_number());
+}
+
+TEST(chunk_flags, root_references_while_marking)
+{
+    using chunk_flags = def::detail::memory_chunk_header::chunk_flags;
+    constexpr int changes_number = 100000;
+
+    chunk_flags flags{false, false};
+    flags.increment_root_reference();
+    // roots change while other thread marks same word
+    std::thread marker{[&flags]
+    {
+        for (int i = 0; i != changes_number; ++i)
+            flags.try_mark_visited(static_cast<chunk_flags::epoch_type>(
+                    i % chunk_flags::max_epoch + 1));
+    }};
+    for (int i = 0; i != changes_number; ++i)
+    {
+        flags.increment_root_reference();
+        flags.decrement_root_reference();
+    }
+    marker.join();
+
+    EXPECT_TRUE(flags.is_visited(static_cast<chunk_flags::epoch_type>(
+            (changes_number - 1) % chunk_flags::max_epoch + 1)));
+    EXPECT_TRUE(flags.is_root());
+    flags.decrement_root_reference();
+    EXPECT_FALSE(flags.is_root());
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <list>
 #include <array>
+#include <cstddef>
 
 #include "deferred/deferred_ptr"
 #include "deferred/defines"
@@ -400,3 +401,47 @@ TEST(inner_traits, is_container_of_deferred_ptr)
     EXPECT_TRUE(def::detail::is_container_of_deferred_ptr<
             std::vector<def::root_ptr<dummy>>>::value);
 }
+
+TEST(inner_traits, is_leaf)
+{
+    using def::detail::object_traverse_helper;
+
+    EXPECT_TRUE(object_traverse_helper<int>::is_leaf());
+    EXPECT_TRUE(object_traverse_helper<std::string>::is_leaf());
+    EXPECT_TRUE(object_traverse_helper<simple_struct>::is_leaf());
+    EXPECT_TRUE(object_traverse_helper<child_struct_one>::is_leaf());
+    EXPECT_TRUE(object_traverse_helper<empty_visitor>::is_leaf());
+
+    EXPECT_FALSE(object_traverse_helper<deferred_struct>::is_leaf());
+    EXPECT_FALSE(object_traverse_helper<
+            deferred_child_struct_simple_one>::is_leaf());
+    EXPECT_FALSE(object_traverse_helper<
+            deferred_child_struct_one_with_user>::is_leaf());
+    EXPECT_FALSE(object_traverse_helper<
+            deferred_child_struct_two_with_user>::is_leaf());
+    EXPECT_FALSE(object_traverse_helper<
+            deferred_child2_struct_two_with_user>::is_leaf());
+    EXPECT_FALSE(object_traverse_helper<right_visitor>::is_leaf());
+}
+
+TEST(inner_traits, pointer_offsets)
+{
+    using def::detail::object_traverse_helper;
+    using helper = object_traverse_helper<deferred_struct>;
+
+    EXPECT_TRUE(object_traverse_helper<
+            deferred_child_struct_one_with_user>::has_pointer_offsets());
+    EXPECT_FALSE(object_traverse_helper<right_visitor>::has_pointer_offsets());
+    // not standard layout, offsets of such type are not known
+    EXPECT_FALSE(object_traverse_helper<
+            deferred_child_struct_two_with_user>::has_pointer_offsets());
+    ASSERT_TRUE(helper::has_pointer_offsets());
+    ASSERT_EQ(1u, helper::get_pointers_number());
+
+    deferred_struct object;
+    std::size_t offsets[1] = {};
+    EXPECT_EQ(offsets + 1, helper::get_pointer_offsets(offsets));
+    EXPECT_EQ(reinterpret_cast<const unsigned char*>(&object.ptr)
+              - reinterpret_cast<const unsigned char*>(&object),
+              static_cast<std::ptrdiff_t>(offsets[0]));
+}